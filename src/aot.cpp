@@ -0,0 +1,397 @@
+// Ahead-of-time recompiler: turns a ROM into a C++ translation unit
+// that implements its basic blocks as functions (see chip8AotModule).
+//
+// The ROM is loaded at 0x200 like chip8::loadGame does and followed from
+// there: jumps, calls, the instruction after a call (where its return
+// lands) and both ways out of every skip. What can't be followed, such as
+// BNNN targets, or code that is only written at run time, has no block
+// and runs on the interpreter. Linking the output into a program that
+// uses BACKEND_AOT is all it takes to run the ROM on it.
+//
+// Blocks are formed like chip8Jit forms them and compile the same
+// instructions, plus the delay timer and big font loads, so they behave
+// exactly like decodeOpcode.
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "chip8-aot.h"
+#include "chip8-decode.h"
+
+struct aotBlock
+{
+	unsigned short start, end, count;
+	bool jumps;
+	std::string body;
+};
+
+class aotCompiler
+{
+public:
+	explicit aotCompiler(const std::vector<unsigned char>& rom)
+	{
+		// Blocks may look past the ROM, e.g. at what follows a final skip
+		memory.assign(mem::pcMask + 1 + mem::mirrorSize, 0);
+		std::copy(rom.begin(), rom.begin() + std::min<size_t>(rom.size(), 0x1000 - 0x200), memory.begin() + 0x200);
+		romEnd = unsigned(0x200 + std::min<size_t>(rom.size(), 0x1000 - 0x200));
+	}
+
+	// Follows the control flow from 0x200 and compiles every block reached
+	void run()
+	{
+		std::vector<unsigned> work = { 0x200 };
+		std::set<unsigned> seen;
+		while (!work.empty())
+		{
+			const unsigned a = work.back();
+			work.pop_back();
+			if (a < 0x200 || a >= romEnd || !seen.insert(a).second) { continue; }
+
+			std::vector<unsigned> next;
+			compile(a, next);
+			work.insert(work.end(), next.begin(), next.end());
+		}
+	}
+
+	void write(std::ostream& out, const std::string& name, const std::string& source) const;
+
+	size_t blockCount() const { return blocks.size(); }
+
+private:
+	std::vector<unsigned char> memory;
+	unsigned romEnd;
+	std::map<unsigned, aotBlock> blocks;
+
+	const decodedOp& at(unsigned a) const { return decodeTable()[memory[a] << 8 | memory[a + 1]]; }
+
+	unsigned next2(unsigned a) const { return (a + 2) & mem::pcMask; }
+	// Where a taken skip lands, it steps over F000 NNNN as a whole
+	unsigned next4(unsigned a) const
+	{
+		const unsigned n = next2(a);
+		return (n + (memory[n] == 0xF0 && memory[n + 1] == 0x00 ? 4 : 2)) & mem::pcMask;
+	}
+
+	void successors(unsigned a, const decodedOp& d, std::vector<unsigned>& next) const;
+	void compile(unsigned start, std::vector<unsigned>& next);
+};
+
+// Where the instruction at a can continue, as far as it is known statically
+void aotCompiler::successors(unsigned a, const decodedOp& d, std::vector<unsigned>& next) const
+{
+	switch (d.kind)
+	{
+	case OP_JP:
+		next.push_back(d.nnn);
+		break;
+	case OP_CALL:
+		next.push_back(d.nnn);
+		next.push_back(next2(a));
+		break;
+	case OP_SE_NN:
+	case OP_SNE_NN:
+	case OP_SE_XY:
+	case OP_SNE_XY:
+	case OP_SKP:
+	case OP_SKNP:
+		next.push_back(next2(a));
+		next.push_back(next4(a));
+		break;
+	case OP_LD_I_LONG:
+		next.push_back((a + 4) & mem::pcMask);
+		break;
+	// Returns land after calls, BNNN is unknown until it runs
+	case OP_RET:
+	case OP_JP_V0:
+	case OP_EXIT:
+	case OP_UNKNOWN:
+		break;
+	default:
+		next.push_back(next2(a));
+		break;
+	}
+}
+
+static std::string hex(unsigned v, int digits = 3)
+{
+	std::ostringstream s;
+	s << "0x" << std::uppercase << std::hex << std::setfill('0') << std::setw(digits) << v;
+	return s.str();
+}
+
+static std::string reg(unsigned r)
+{
+	char buf[4];
+	std::snprintf(buf, sizeof buf, "v%X", r);
+	return buf;
+}
+
+void aotCompiler::compile(unsigned start, std::vector<unsigned>& next)
+{
+	std::ostringstream body;
+	std::set<unsigned> reads, writes;	// Registers the block touches
+	bool usesI = false;
+	unsigned addr = start;
+	unsigned short count = 0;
+	bool ended = false, jumps = false, skips = false;
+	std::string pc;
+
+	while (!ended && count < chip8AotModule::maxBlockLength && addr + 2 <= mem::pcMask)
+	{
+		const decodedOp& d = at(addr);
+		const std::string x = reg(d.x), y = reg(d.y), f = reg(0xF);
+		std::ostringstream line;
+
+		switch (d.kind)
+		{
+		case OP_LD_NN:	line << x << " = " << hex(d.nn, 2) << ";"; break;
+		case OP_ADD_NN:	line << x << " += " << hex(d.nn, 2) << ";"; break;
+		case OP_LD_XY:	line << x << " = " << y << ";"; break;
+		case OP_OR:		line << x << " |= " << y << ";"; break;
+		case OP_AND:	line << x << " &= " << y << ";"; break;
+		case OP_XOR:	line << x << " ^= " << y << ";"; break;
+		// VF first, like decodeOpcode, the results stay exact when X or Y is F
+		case OP_ADD_XY:	line << f << " = " << y << " > 0xFF - " << x << "; " << x << " += " << y << ";"; break;
+		case OP_SUB:	line << f << " = " << y << " <= " << x << "; " << x << " -= " << y << ";"; break;
+		case OP_SHR:	line << f << " = " << x << " & 1; " << x << " >>= 1;"; break;
+		case OP_SUBN:	line << f << " = " << y << " >= " << x << "; " << x << " = " << y << " - " << x << ";"; break;
+		case OP_SHL:	line << f << " = " << x << " >> 7; " << x << " <<= 1;"; break;
+		case OP_LD_I:	line << "i = " << hex(d.nnn) << ";"; usesI = true; break;
+		case OP_ADD_I:
+			line << f << " = " << x << " > s.addrMask() - i; "
+				<< "i = (unsigned short)((i + " << x << ") & s.addrMask());";
+			usesI = true;
+			break;
+		case OP_LD_F:	line << "i = " << x << " * 5;"; usesI = true; break;
+		case OP_LD_HF:	line << "i = " << hex(mem::bigFontAddr) << " + (" << x << " & 0xF) * 10;"; usesI = true; break;
+		case OP_LD_VX_DT: line << x << " = s.delay_timer;"; break;
+		case OP_LD_DT:	line << "s.delay_timer = " << x << ";"; break;
+		case OP_LOAD:
+			for (unsigned r = 0; r <= d.x; r++)
+				line << (r ? " " : "") << reg(r) << " = s.memory[i + " << r << "];";
+			usesI = true;
+			break;
+
+		// Control flow ends the block
+		case OP_SE_NN:
+		case OP_SNE_NN:
+		case OP_SE_XY:
+		case OP_SNE_XY:
+		{
+			const bool equal = d.kind == OP_SE_NN || d.kind == OP_SE_XY;
+			const std::string other = d.kind == OP_SE_NN || d.kind == OP_SNE_NN ? hex(d.nn, 2) : y;
+			// 5XX0 always skips and 9XX0 never does
+			if (other == x) { pc = hex(equal ? next4(addr) : next2(addr)); }
+			else { pc = x + (equal ? " == " : " != ") + other + " ? " + hex(next4(addr)) + " : " + hex(next2(addr)); }
+			ended = skips = true;
+			break;
+		}
+		case OP_JP:
+			pc = hex(d.nnn);
+			ended = jumps = true;
+			break;
+		case OP_JP_V0:
+			pc = "(" + hex(d.nnn) + " + " + reg(0) + ") & " + hex(mem::pcMask);
+			ended = true;
+			break;
+		case OP_CALL:
+			line << "s.stack[s.sp] = " << hex(addr) << "; s.sp = (s.sp + 1) % 0xF;";
+			pc = hex(d.nnn);
+			ended = true;
+			break;
+		case OP_RET:
+			line << "s.sp = (s.sp - 1) & 0xF;";
+			pc = "(s.stack[s.sp] + 2) & " + hex(mem::pcMask);
+			ended = true;
+			break;
+
+		default:
+			// Left to the interpreter
+			goto done;
+		}
+
+		switch (d.kind)
+		{
+		case OP_LD_NN: case OP_ADD_NN: case OP_LD_VX_DT:
+			writes.insert(d.x);
+			break;
+		case OP_LD_XY: case OP_OR: case OP_AND: case OP_XOR:
+		case OP_ADD_XY: case OP_SUB: case OP_SUBN:
+			reads.insert(d.y);
+			writes.insert(d.x);
+			writes.insert(0xF);
+			break;
+		case OP_SHR: case OP_SHL:	// Y is ignored
+			writes.insert(d.x);
+			writes.insert(0xF);
+			break;
+		case OP_ADD_I:
+			reads.insert(d.x);
+			writes.insert(0xF);
+			break;
+		case OP_LOAD:
+			for (unsigned r = 0; r <= d.x; r++)
+				writes.insert(r);
+			break;
+		case OP_SE_XY: case OP_SNE_XY:
+			if (d.x == d.y) { break; }
+			reads.insert(d.y);
+			reads.insert(d.x);
+			break;
+		case OP_JP_V0:
+			reads.insert(0);
+			break;
+		case OP_SE_NN: case OP_SNE_NN: case OP_LD_F: case OP_LD_HF: case OP_LD_DT:
+			reads.insert(d.x);
+			break;
+		default:
+			break;
+		}
+
+		{
+			char text[32];
+			disassemble((unsigned short)(memory[addr] << 8 | memory[addr + 1]), text, sizeof text);
+			const std::string code = line.str();
+			char where[8];
+			std::snprintf(where, sizeof where, "%03X", addr);
+			if (!code.empty()) { body << "\t" << code << "\t// " << where << ": " << text << "\n"; }
+			else { body << "\t// " << where << ": " << text << "\n"; }
+		}
+
+		if (ended) { successors(addr, d, next); }
+		addr += 2;
+		count++;
+	}
+done:
+	if (!count)
+	{
+		// Interpreted, go on where it would
+		successors(start, at(start), next);
+		return;
+	}
+	if (!ended) { next.push_back(addr); }
+
+	aotBlock& b = blocks[start];
+	b.start = (unsigned short)start;
+	b.end = (unsigned short)(skips ? std::min(addr + 2, 0x1000u) : addr);
+	b.count = count;
+	b.jumps = jumps;
+
+	// Registers live in locals for the whole block, the
+	// ones it writes are stored back before it leaves
+	std::set<unsigned> regs = reads;
+	regs.insert(writes.begin(), writes.end());
+	std::ostringstream fn;
+	for (auto r : regs)
+		fn << "\tunsigned char " << reg(r) << " = s.V[" << r << "];\n";
+	if (usesI) { fn << "\tunsigned short i = s.I;\n"; }
+	fn << body.str();
+	for (auto r : writes)
+		fn << "\ts.V[" << r << "] = " << reg(r) << ";\n";
+	if (usesI) { fn << "\ts.I = i;\n"; }
+	if (ended) { fn << "\ts.pc = (unsigned short)(" << pc << ");\n"; }
+	else { fn << "\ts.pc = " << hex(addr) << ";\n"; }
+	b.body = fn.str();
+}
+
+void aotCompiler::write(std::ostream& out, const std::string& name, const std::string& source) const
+{
+	out << "// Generated by chip8-aot from " << source << ", do not edit\n\n"
+		<< "#include \"chip8-aot.h\"\n\n"
+		<< "namespace\n{\n\n";
+
+	unsigned codeEnd = romEnd;
+	for (auto& kv : blocks)
+	{
+		const aotBlock& b = kv.second;
+		codeEnd = std::max<unsigned>(codeEnd, b.end);
+		out << "void block" << hex(b.start).substr(2) << "(chip8State& s)\n{\n" << b.body << "}\n\n";
+	}
+
+	// Arrays can't be empty, a ROM without blocks gets one byte of code
+	out << "const unsigned char code[] =\n{";
+	for (unsigned a = 0x200; a < std::max(codeEnd, 0x201u); a++)
+		out << ((a - 0x200) % 16 ? " " : "\n\t") << hex(memory[a], 2) << ",";
+	out << "\n};\n\n";
+
+	out << "const chip8AotModule::block blocks[] =\n{\n";
+	for (auto& kv : blocks)
+	{
+		const aotBlock& b = kv.second;
+		out << "\t{ " << hex(b.start) << ", " << hex(b.end) << ", " << b.count << ", "
+			<< (b.jumps ? "true" : "false") << ", block" << hex(b.start).substr(2) << " },\n";
+	}
+	if (blocks.empty()) { out << "\t{ 0, 0, 0, false, nullptr },\n"; }
+	out << "};\n\n";
+
+	out << "const chip8AotModule module = { \"" << name << "\", code, sizeof code, blocks, "
+		<< blocks.size() << " };\n"
+		<< "const chip8AotRegistrar registrar(module);\n\n"
+		<< "}\n";
+}
+
+static int usage()
+{
+	std::fprintf(stderr,
+		"usage: chip8-aot [-o out.cpp] [-n name] rom\n"
+		"  -o <file>  where to write the C++ (default: stdout)\n"
+		"  -n <name>  module name (default: the ROM file name)\n");
+	return 2;
+}
+
+int main(int argc, char* argv[])
+{
+	std::string romPath, outPath, name;
+	for (int i = 1; i < argc; i++)
+	{
+		const std::string arg = argv[i];
+		const bool hasValue = i + 1 < argc;
+		if (arg == "-o" && hasValue) { outPath = argv[++i]; }
+		else if (arg == "-n" && hasValue) { name = argv[++i]; }
+		else if (arg[0] == '-' || !romPath.empty()) { return usage(); }
+		else { romPath = arg; }
+	}
+	if (romPath.empty()) { return usage(); }
+
+	std::ifstream f(romPath, std::ios::binary);
+	if (!f)
+	{
+		std::fprintf(stderr, "can't open %s\n", romPath.c_str());
+		return 1;
+	}
+	const std::vector<unsigned char> rom((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+
+	const auto file = romPath.substr(romPath.find_last_of("/\\") + 1);
+	if (name.empty()) { name = file.substr(0, file.find_last_of('.')); }
+	// It ends up in a string literal
+	for (auto& ch : name)
+		if (ch == '"' || ch == '\\' || (unsigned char)ch < 0x20) { ch = '_'; }
+
+	aotCompiler c(rom);
+	c.run();
+	if (!c.blockCount()) { std::fprintf(stderr, "%s: no code to compile\n", romPath.c_str()); }
+
+	if (outPath.empty())
+	{
+		c.write(std::cout, name, file);
+		return 0;
+	}
+
+	std::ofstream out(outPath);
+	c.write(out, name, file);
+	if (!out)
+	{
+		std::fprintf(stderr, "can't write %s\n", outPath.c_str());
+		return 1;
+	}
+	return 0;
+}
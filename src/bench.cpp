@@ -0,0 +1,769 @@
+// Headless benchmark for the emulation core.
+//
+// Every ROM runs on every selected backend for a fixed number of
+// instructions, timers tick once per frame of instructions and FX0A is
+// answered right away. A ROM that stops (infinite loop, unknown opcode)
+// starts over. Two passes are made:
+//
+// - throughput: frames are run with emulateCycle like the frontend does.
+//   A frame that halts partway (stop or FX0A) is left out of the
+//   numbers, emulateCycle doesn't say how much of it ran.
+// - profile: instructions are single-stepped and timed one by one,
+//   grouped by the top nibble of the opcode. The cost of reading the
+//   clock is measured and subtracted, the cost of calling emulateCycle
+//   is not. The recompiler only runs blocks that fit in a single step, so
+//   its profile is mostly the table interpreter.
+//
+// Without ROM arguments a built-in loop that uses every opcode class is run,
+// --diff also runs the built-in regression ROMs.
+// With --profile each ROM also runs once more on the first backend with
+// a chip8Profile recording, written as a report and as collapsed stacks.
+// With --diff nothing is timed, every selected backend runs in lockstep
+// with the switch interpreter (chip8Diff) and the first instruction
+// where one of them behaves differently is reported.
+// With --pool the ROM runs on many machines through chip8Pool, a few
+// runs in a row, and every machine is checked against the same machine
+// run on this thread alone. Both are timed.
+// With --batch the ROM runs on the lanes of a chip8Batch and on as many
+// machines one after the other, both are timed and compared after every
+// frame. Lanes that stop (SUPER-CHIP code, see chip8Batch) are left out.
+// With --trace the throughput pass also encodes every instruction into a
+// trace file (chip8TraceWriter), one stream per ROM and backend in the
+// order they run, so the numbers include what tracing costs.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "chip8-batch.h"
+#include "chip8-cpu.h"
+#include "chip8-diff.h"
+#include "chip8-movie.h"
+#include "chip8-pool.h"
+#include "chip8-tracefile.h"
+
+typedef std::chrono::steady_clock benchClock;
+
+static const char* const backendNames[] = { "switch", "table", "jit", "cached", "aot" };
+
+static const unsigned char builtinRom[] =
+{
+	0x6A, 0x3F,	//200: VA = 3F, masks for the sprite position
+	0x6B, 0x1F,	//202: VB = 1F
+	0x60, 0x00,	//204: V0 = 0
+	0x70, 0x01,	//206: loop: V0 += 1
+	0x81, 0x04,	//208: V1 += V0
+	0x82, 0x13,	//20A: V2 ^= V1
+	0x81, 0x26,	//20C: V1 >>= 1
+	0xC5, 0x0F,	//20E: V5 = rand & 0F
+	0x30, 0x00,	//210: skip if V0 == 0
+	0x6E, 0x01,
+	0x45, 0x00,	//214: skip if V5 != 0
+	0x6E, 0x02,
+	0x50, 0x10,	//218: skip if V0 == V1
+	0x6E, 0x03,
+	0x90, 0x10,	//21C: skip if V0 != V1
+	0x6E, 0x04,
+	0xE5, 0x9E,	//220: skip if key V5 is down
+	0x6E, 0x05,
+	0xE5, 0xA1,	//224: skip if key V5 is up
+	0x6E, 0x06,
+	0x00, 0xE0,	//228: clear the screen
+	0xF5, 0x29,	//22A: I = glyph of V5
+	0x83, 0x00,	//22C: V3 = V0 & VA
+	0x83, 0xA2,
+	0x84, 0x10,	//230: V4 = V1 & VB
+	0x84, 0xB2,
+	0xD3, 0x45,	//234: draw the glyph
+	0xA3, 0x00,	//236: I = 300
+	0xF3, 0x33,	//238: BCD of V3
+	0xF7, 0x55,	//23A: store V0..V7
+	0xF7, 0x65,	//23C: load them back
+	0xF0, 0x1E,	//23E: I += V0
+	0xF7, 0x15,	//240: delay = V7
+	0xF8, 0x07,	//242: V8 = delay
+	0x22, 0x52,	//244: call the subroutine
+	0x8C, 0x00,	//246: VC = V0
+	0x60, 0x00,	//248: V0 = 0
+	0xB2, 0x4E,	//24A: jump to V0 + back
+	0x00, 0x00,	//24C: never executed
+	0x80, 0xC0,	//24E: back: V0 = VC
+	0x12, 0x06,	//250: jump to loop
+	0x00, 0xEE,	//252: sub: return
+};
+
+struct benchRom
+{
+	std::string name;
+	std::vector<unsigned char> data;
+};
+
+// Regression ROMs for --diff, each of them once broke a backend
+
+// 64 FX65 with X=F, the longest block chip8Jit compiles, rewritten
+// over and over so it is compiled until the arena is full
+static benchRom jitArenaRom()
+{
+	std::vector<unsigned char> rom = {
+		0x60, 0xFF,	//200: V0 = FF
+		0x61, 0x65,	//202: V1 = 65
+		0xA3, 0x00,	//204: I = 300
+		0xF1, 0x55,	//206: store V0..V1, the same bytes
+		0x13, 0x00,	//208: jump to 300
+	};
+	rom.resize(0x100);
+	for (unsigned i = 0; i < 64; i++)
+		rom.insert(rom.end(), { 0xFF, 0x65 });	//300: load V0..VF
+	rom.insert(rom.end(), { 0x12, 0x00 });		//380: jump to 200
+	return { "jit-arena", rom };
+}
+
+struct benchOptions
+{
+	unsigned long long instructions = 20000000;	//Per ROM and backend, throughput pass
+	unsigned long long profiled = 1000000;		//Per ROM and backend, profile pass
+	unsigned frame = 1000;						//Instructions between timer ticks
+	std::vector<cpuBackend> backends;
+	bool json = false;
+	std::string profileDir;	//Where to write chip8Profile output, empty for none
+	bool diff = false;		//Compare backends instead of timing them
+	chip8Movie input;		//Keypad for --diff, FX0A is answered right away without one
+	bool hasInput = false;
+	unsigned poolMachines = 0;	//Check chip8Pool with this many machines instead of timing backends
+	unsigned poolThreads = 0;	//Its workers, 0 for one per core
+	bool batch = false;			//Check and time chip8Batch against the first backend
+	chip8TraceWriter* trace = nullptr;	//Gets the throughput pass, if set
+};
+
+struct benchResult
+{
+	cpuBackend backend;
+
+	//Throughput pass
+	unsigned long long instructions;
+	double seconds;
+	unsigned restarts;
+	unsigned halted;	//Frames left out
+
+	//Profile pass, by top nibble of the opcode
+	unsigned long long count[16];
+	double ns[16];
+	unsigned long long drawRows;	//Sum of N over all DXYN
+
+	double mips() const { return seconds > 0 ? instructions / seconds / 1e6 : 0; }
+	double nsPerOp(unsigned c) const { return count[c] ? ns[c] / count[c] : 0; }
+	double profiledNs() const
+	{
+		double total = 0;
+		for (auto c : ns) { total += c; }
+		return total;
+	}
+	unsigned long long profiledCount() const
+	{
+		unsigned long long total = 0;
+		for (auto c : count) { total += c; }
+		return total;
+	}
+};
+
+// Drives one machine through a ROM, restarting it when it stops
+class benchMachine
+{
+public:
+	benchMachine(const benchRom& rom, cpuBackend backend)
+	{
+		m.initialize();
+		m.loadRom(rom.data.data(), std::min<size_t>(rom.data.size(), 0x1000 - 0x200), MODE_CHIP8);
+		m.backend = backend;
+		m.saveState(start);
+	}
+
+	// Call after running when isRunning may have changed
+	void settle(bool ok)
+	{
+		if (!ok || (!m.isRunning && !m.waitForKey))
+		{
+			m.loadState(start);
+			m.isRunning = true;
+			restarts++;
+		}
+		else if (m.waitForKey)
+		{
+			m.keyPress(nextKey);
+			m.keyRelease(nextKey);
+			nextKey = (nextKey + 1) & 0xF;
+		}
+	}
+
+	chip8 m;
+	unsigned restarts = 0;
+
+private:
+	chip8State start;
+	unsigned char nextKey = 0;
+};
+
+// Average cost of one clock reading, subtracted from the profile
+static double clockOverheadNs()
+{
+	const unsigned samples = 100000;
+	const auto t0 = benchClock::now();
+	for (unsigned i = 0; i < samples; i++)
+		benchClock::now();
+	const auto t1 = benchClock::now();
+	return std::chrono::duration<double, std::nano>(t1 - t0).count() / samples;
+}
+
+static void throughput(const benchRom& rom, const benchOptions& opt, benchResult& r, unsigned stream)
+{
+	benchMachine bm(rom, r.backend);
+	std::unique_ptr<chip8TraceStream> trace;
+	if (opt.trace)
+	{
+		trace.reset(new chip8TraceStream(*opt.trace, stream));
+		bm.m.setTraceStream(trace.get());
+	}
+	r.instructions = 0;
+	r.seconds = 0;
+	r.halted = 0;
+
+	// Gives up on ROMs that halt nearly every frame
+	const unsigned long long maxFrames = opt.instructions / opt.frame * 4 + 16;
+
+	for (unsigned long long f = 0; r.instructions < opt.instructions && f < maxFrames; f++)
+	{
+		const auto n = unsigned(std::min<unsigned long long>(opt.frame, opt.instructions - r.instructions));
+
+		const auto t0 = benchClock::now();
+		const bool ok = bm.m.emulateCycle(short(n));
+		const auto t1 = benchClock::now();
+
+		if (ok && bm.m.isRunning)
+		{
+			r.instructions += n;
+			r.seconds += std::chrono::duration<double>(t1 - t0).count();
+		}
+		else
+		{
+			r.halted++;
+		}
+
+		bm.m.tickTimers();
+		bm.settle(ok);
+	}
+	r.restarts = bm.restarts;
+}
+
+// Runs the profile pass again untimed with a chip8Profile recording,
+// and writes a report and the collapsed stacks named after the ROM file
+static void writeProfile(const benchRom& rom, const benchOptions& opt)
+{
+	benchMachine bm(rom, opt.backends.front());
+	bm.m.setProfiling(true);
+	for (unsigned long long done = 0; done < opt.profiled; done += opt.frame)
+	{
+		const bool ok = bm.m.emulateCycle(short(std::min<unsigned long long>(opt.frame, opt.profiled - done)));
+		bm.m.tickTimers();
+		bm.settle(ok);
+	}
+
+	auto base = rom.name.substr(rom.name.find_last_of("/\\") + 1);
+	base = opt.profileDir + "/" + base.substr(0, base.find_last_of('.'));
+
+	std::ofstream report(base + ".profile.txt"), folded(base + ".folded");
+	if (!report || !folded)
+	{
+		std::fprintf(stderr, "can't write %s.profile.txt\n", base.c_str());
+		return;
+	}
+	bm.m.getProfile()->writeReport(report, bm.m);
+	bm.m.getProfile()->writeCollapsed(folded);
+}
+
+// Runs every selected backend against the reference, false if any differs
+static bool diffRom(const benchRom& rom, const benchOptions& opt)
+{
+	const uint64_t frames = opt.instructions / opt.frame;
+	bool same = true;
+
+	std::printf("%s\n", rom.name.c_str());
+	for (auto backend : opt.backends)
+	{
+		if (backend == BACKEND_SWITCH) { continue; }
+
+		chip8Diff d(BACKEND_SWITCH, backend);
+		d.load(rom.data.data(), rom.data.size(), MODE_CHIP8);
+		if (opt.hasInput) { d.setInput(opt.input); }
+
+		if (d.run(frames, short(opt.frame)))
+		{
+			std::printf("  %-8s same as switch for %llu frames\n", backendNames[backend],
+				(unsigned long long)d.framesRun());
+			continue;
+		}
+
+		same = false;
+		const auto& r = d.result();
+		char text[32];
+		disassemble(r.opcode, text, sizeof text);
+		if (r.exact)
+		{
+			std::printf("  %-8s differs in frame %llu, instruction %u: %03X %04X %s\n", backendNames[backend],
+				(unsigned long long)r.frame, r.instruction, r.pc, r.opcode, text);
+		}
+		else
+		{
+			std::printf("  %-8s differs at the end of frame %llu, which started at %03X %04X %s\n",
+				backendNames[backend], (unsigned long long)r.frame, r.pc, r.opcode, text);
+		}
+		std::printf("           %s\n", r.what);
+	}
+	return same;
+}
+
+// Names the first part of the state that differs, nullptr if there is none
+static const char* stateDifference(const chip8State& a, const chip8State& b)
+{
+	if (std::memcmp(a.V, b.V, sizeof a.V)) { return "V"; }
+	if (a.I != b.I) { return "I"; }
+	if (a.pc != b.pc) { return "pc"; }
+	if (a.sp != b.sp || std::memcmp(a.stack, b.stack, sizeof a.stack)) { return "stack"; }
+	if (a.delay_timer != b.delay_timer || a.sound_timer != b.sound_timer) { return "timers"; }
+	if (a.rng != b.rng) { return "rng"; }
+	if (a.waitForKey != b.waitForKey) { return "waiting"; }
+	if (std::memcmp(a.pixels, b.pixels, sizeof a.pixels)) { return "pixels"; }
+	if (std::memcmp(a.memory, b.memory, sizeof a.memory)) { return "memory"; }
+	return nullptr;
+}
+
+// The frame callback of the pool check, answers FX0A right away
+static bool poolKeys(chip8& m, unsigned frame)
+{
+	if (m.waitForKey)
+	{
+		m.keyPress(frame & 0xF);
+		m.keyRelease(frame & 0xF);
+	}
+	return true;
+}
+
+// Same as chip8Pool::step with poolKeys, returns the frames run
+static unsigned stepAlone(chip8& m, unsigned frames, short cycles)
+{
+	unsigned f = 0;
+	for (; f < frames; f++)
+	{
+		if (!m.isRunning && !m.waitForKey) { break; }
+		if (!m.emulateCycle(cycles))
+		{
+			m.stopEmulation();
+			break;
+		}
+		m.tickTimers();
+		poolKeys(m, f);
+	}
+	return f;
+}
+
+// Runs the ROM on opt.poolMachines machines through a chip8Pool and on
+// as many machines one after the other, false if any of them differ
+static bool poolRom(const benchRom& rom, const benchOptions& opt)
+{
+	const unsigned runs = 8;
+	const size_t count = opt.poolMachines;
+	const unsigned frames = unsigned(std::max<unsigned long long>(1, opt.instructions / opt.frame / count / runs));
+
+	chip8Pool pool(opt.poolThreads);
+	std::vector<std::unique_ptr<chip8>> alone;
+	for (size_t i = 0; i < count; i++)
+	{
+		alone.emplace_back(new chip8);
+		chip8* both[] = { &pool[pool.add()], alone.back().get() };
+		for (auto m : both)
+		{
+			m->initialize();
+			m->loadRom(rom.data.data(), std::min<size_t>(rom.data.size(), 0x1000 - 0x200), MODE_CHIP8);
+			m->backend = opt.backends.front();
+			m->seed(i);
+			m->isRunning = true;
+		}
+	}
+
+	std::printf("%s\n", rom.name.c_str());
+	double poolSeconds = 0, aloneSeconds = 0;
+	unsigned long long framesRun = 0;
+	for (unsigned r = 0; r < runs; r++)
+	{
+		auto t0 = benchClock::now();
+		pool.run(frames, short(opt.frame), [](size_t, chip8& m, unsigned f) { return poolKeys(m, f); });
+		auto t1 = benchClock::now();
+		poolSeconds += std::chrono::duration<double>(t1 - t0).count();
+
+		t0 = benchClock::now();
+		for (auto& m : alone)
+			framesRun += stepAlone(*m, frames, short(opt.frame));
+		t1 = benchClock::now();
+		aloneSeconds += std::chrono::duration<double>(t1 - t0).count();
+
+		for (size_t i = 0; i < count; i++)
+		{
+			const char* what = stateDifference(pool[i], *alone[i]);
+			if (!what) { continue; }
+			std::printf("  pool     machine %zu differs from running alone after run %u: %s\n", i, r + 1, what);
+			return false;
+		}
+	}
+
+	const double instructions = double(framesRun) * opt.frame;
+	std::printf("  pool     %zu machines, %u runs on %u workers: %.2f MIPS, alone %.2f MIPS, same\n",
+		count, runs, pool.workers(), instructions / poolSeconds / 1e6, instructions / aloneSeconds / 1e6);
+	return true;
+}
+
+// Runs the ROM on every lane of a chip8Batch and on as many machines,
+// false if a lane that is still running differs from its machine
+static bool batchRom(const benchRom& rom, const benchOptions& opt)
+{
+	const unsigned lanes = chip8Batch::lanes;
+	const unsigned long long frames = std::max<unsigned long long>(1, opt.instructions / opt.frame / lanes);
+
+	// Static so that its vectors are aligned, load() resets every lane
+	static chip8Batch batch;
+	const uint64_t steps = batch.steps();
+	std::vector<std::unique_ptr<chip8>> machines;
+	for (unsigned l = 0; l < lanes; l++)
+	{
+		machines.emplace_back(new chip8);
+		chip8& m = *machines.back();
+		m.initialize();
+		m.loadRom(rom.data.data(), std::min<size_t>(rom.data.size(), 0x1000 - 0x200), MODE_CHIP8);
+		m.backend = opt.backends.front();
+		m.seed(l);
+		m.isRunning = true;
+		batch.load(l, m);
+	}
+
+	std::printf("%s\n", rom.name.c_str());
+	double batchSeconds = 0, scalarSeconds = 0;
+	unsigned long long instructions = 0;
+	uint32_t checked = (1ull << lanes) - 1;	//Lanes still compared
+	for (unsigned long long f = 0; f < frames && checked; f++)
+	{
+		auto t0 = benchClock::now();
+		instructions += batch.run(opt.frame);
+		batch.tickTimers();
+		auto t1 = benchClock::now();
+		batchSeconds += std::chrono::duration<double>(t1 - t0).count();
+
+		t0 = benchClock::now();
+		for (auto& m : machines)
+		{
+			if (!m->isRunning && !m->waitForKey) { continue; }
+			if (!m->emulateCycle(short(opt.frame))) { m->stopEmulation(); }
+			m->tickTimers();
+		}
+		t1 = benchClock::now();
+		scalarSeconds += std::chrono::duration<double>(t1 - t0).count();
+
+		// FX0A is answered right away, pressing a key elsewhere
+		// is the same on both sides
+		const unsigned char key = f & 0xF;
+		for (unsigned l = 0; l < lanes; l++)
+		{
+			if (!(checked >> l & 1)) { continue; }
+			chip8& m = *machines[l];
+			if (!batch.running(l))
+			{
+				checked &= ~(1u << l);
+				continue;
+			}
+
+			// What the batch doesn't model comes from the machine
+			chip8State s = m;
+			batch.store(l, s);
+			if (const char* what = stateDifference(s, m))
+			{
+				std::printf("  batch    lane %u differs from %s in frame %llu: %s\n",
+					l, backendNames[m.backend], f, what);
+				return false;
+			}
+
+			batch.keyPress(l, key);
+			batch.keyRelease(l, key);
+			m.keyPress(key);
+			m.keyRelease(key);
+		}
+	}
+
+	unsigned stopped = 0;
+	for (unsigned l = 0; l < lanes; l++)
+		stopped += !(checked >> l & 1);
+	std::printf("  batch    %u lanes: %.2f MIPS, %s %.2f MIPS, %.1f lanes per step, %u stopped, same\n",
+		lanes, instructions / batchSeconds / 1e6, backendNames[opt.backends.front()],
+		instructions / scalarSeconds / 1e6, double(instructions) / (batch.steps() - steps), stopped);
+	return true;
+}
+
+static void profile(const benchRom& rom, const benchOptions& opt, double overhead, benchResult& r)
+{
+	benchMachine bm(rom, r.backend);
+	std::fill_n(r.count, 16, 0);
+	std::fill_n(r.ns, 16, 0.0);
+	r.drawRows = 0;
+
+	for (unsigned long long i = 0; i < opt.profiled; i++)
+	{
+		const unsigned short pc = bm.m.pc;
+		const unsigned op = bm.m.memory[pc] << 8 | bm.m.memory[pc + 1];
+
+		const auto t0 = benchClock::now();
+		const bool ok = bm.m.emulateCycle(1);
+		const auto t1 = benchClock::now();
+
+		const auto c = op >> 12;
+		r.count[c]++;
+		r.ns[c] += std::max(0.0, std::chrono::duration<double, std::nano>(t1 - t0).count() - overhead);
+		if (c == 0xD) { r.drawRows += op & 0xF; }
+
+		if ((i + 1) % opt.frame == 0) { bm.m.tickTimers(); }
+		bm.settle(ok);
+	}
+}
+
+static void printText(const benchRom& rom, const std::vector<benchResult>& results)
+{
+	std::printf("%s\n", rom.name.c_str());
+	std::printf("  %-8s %10s %10s %9s %7s\n", "backend", "MIPS", "ns/instr", "restarts", "halted");
+	for (auto& r : results)
+	{
+		std::printf("  %-8s %10.2f %10.2f %9u %7u\n", backendNames[r.backend], r.mips(),
+			r.instructions ? 1e9 * r.seconds / r.instructions : 0.0, r.restarts, r.halted);
+	}
+
+	// Opcode mix is the same on every backend, CXNN starts from the same seed
+	const auto& first = results.front();
+	std::printf("\n  %-6s %7s", "class", "mix%");
+	for (auto& r : results)
+		std::printf(" %8s", backendNames[r.backend]);
+	std::printf("   (ns per instruction, single-stepped)\n");
+	for (unsigned c = 0; c < 16; c++)
+	{
+		if (!first.count[c]) { continue; }
+		std::printf("  %XNNN   %7.2f", c, 100.0 * first.count[c] / first.profiledCount());
+		for (auto& r : results)
+			std::printf(" %8.2f", r.nsPerOp(c));
+		std::printf("\n");
+	}
+
+	if (first.count[0xD])
+	{
+		std::printf("\n  DXYN: %.2f rows on average\n", double(first.drawRows) / first.count[0xD]);
+		for (auto& r : results)
+		{
+			std::printf("  %-8s %8.2f ns per draw, %6.2f ns per row, %5.1f%% of the time\n",
+				backendNames[r.backend], r.nsPerOp(0xD), r.ns[0xD] / r.drawRows,
+				100.0 * r.ns[0xD] / r.profiledNs());
+		}
+	}
+	std::printf("\n");
+}
+
+static void printJsonString(const std::string& s)
+{
+	std::putchar('"');
+	for (auto ch : s)
+	{
+		if (ch == '"' || ch == '\\') { std::printf("\\%c", ch); }
+		else if ((unsigned char)ch < 0x20) { std::printf("\\u%04x", ch); }
+		else { std::putchar(ch); }
+	}
+	std::putchar('"');
+}
+
+static void printJson(const benchRom& rom, const std::vector<benchResult>& results, bool last)
+{
+	std::printf("    {\"rom\": ");
+	printJsonString(rom.name);
+	std::printf(", \"results\": [\n");
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const auto& r = results[i];
+		std::printf("      {\"backend\": \"%s\", \"instructions\": %llu, \"seconds\": %.6f, "
+			"\"mips\": %.3f, \"restarts\": %u, \"halted\": %u,\n",
+			backendNames[r.backend], r.instructions, r.seconds, r.mips(), r.restarts, r.halted);
+
+		std::printf("       \"classes\": [");
+		for (unsigned c = 0; c < 16; c++)
+			std::printf("%s{\"class\": \"%X\", \"count\": %llu, \"ns\": %.3f}", c ? ", " : "", c, r.count[c], r.nsPerOp(c));
+		std::printf("],\n");
+
+		std::printf("       \"dxyn\": {\"count\": %llu, \"rows\": %llu, \"ns\": %.3f, \"share\": %.4f}}%s\n",
+			r.count[0xD], r.drawRows, r.nsPerOp(0xD),
+			r.profiledNs() > 0 ? r.ns[0xD] / r.profiledNs() : 0.0,
+			i + 1 < results.size() ? "," : "");
+	}
+	std::printf("    ]}%s\n", last ? "" : ",");
+}
+
+static int usage()
+{
+	std::fprintf(stderr,
+		"usage: chip8-bench [options] [rom...]\n"
+		"  -n <count>    instructions per ROM and backend (default 20000000)\n"
+		"  -p <count>    instructions to single-step for the opcode profile (default 1000000)\n"
+		"  -f <count>    instructions per 60Hz frame, 1 to 32767 (default 1000)\n"
+		"  -b <backend>  switch, table, jit, cached, aot or all, can be repeated (default all)\n"
+		"  --json        machine readable output\n"
+		"  --profile <dir>  write a profile report and collapsed stacks per ROM\n"
+		"  --diff        check every backend against switch instead of timing them\n"
+		"  --input <movie>  keypad for --diff, one state per frame\n"
+		"  --pool <count>   check and time chip8Pool with this many machines per ROM\n"
+		"  -t <count>    workers for --pool (default one per core)\n"
+		"  --batch       check and time the batch engine against the first backend\n"
+		"  --trace <file>   trace the throughput pass, a stream per ROM and backend\n");
+	return 2;
+}
+
+int main(int argc, char* argv[])
+{
+	benchOptions opt;
+	std::vector<benchRom> roms;
+	std::string tracePath;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const std::string arg = argv[i];
+		const bool hasValue = i + 1 < argc;
+
+		if (arg == "--json") { opt.json = true; }
+		else if (arg == "--profile" && hasValue) { opt.profileDir = argv[++i]; }
+		else if (arg == "--diff") { opt.diff = true; }
+		else if (arg == "--batch") { opt.batch = true; }
+		else if (arg == "--pool" && hasValue) { opt.poolMachines = unsigned(std::strtoul(argv[++i], nullptr, 10)); }
+		else if (arg == "--trace" && hasValue) { tracePath = argv[++i]; }
+		else if (arg == "--input" && hasValue)
+		{
+			std::ifstream f(argv[++i], std::ios::binary);
+			if (!opt.input.load(f))
+			{
+				std::fprintf(stderr, "can't read the movie %s\n", argv[i]);
+				return 1;
+			}
+			opt.hasInput = true;
+		}
+		else if (arg == "-n" && hasValue) { opt.instructions = std::strtoull(argv[++i], nullptr, 10); }
+		else if (arg == "-p" && hasValue) { opt.profiled = std::strtoull(argv[++i], nullptr, 10); }
+		else if (arg == "-t" && hasValue) { opt.poolThreads = unsigned(std::strtoul(argv[++i], nullptr, 10)); }
+		else if (arg == "-f" && hasValue) { opt.frame = unsigned(std::strtoul(argv[++i], nullptr, 10)); }
+		else if (arg == "-b" && hasValue)
+		{
+			const std::string name = argv[++i];
+			if (name == "all") { continue; }
+			auto found = std::find_if(std::begin(backendNames), std::end(backendNames),
+				[&](const char* n) { return name == n; });
+			if (found == std::end(backendNames)) { return usage(); }
+			opt.backends.push_back(cpuBackend(found - std::begin(backendNames)));
+		}
+		else if (arg[0] == '-') { return usage(); }
+		else
+		{
+			std::ifstream f(arg, std::ios::binary);
+			if (!f)
+			{
+				std::fprintf(stderr, "can't open %s\n", arg.c_str());
+				return 1;
+			}
+			roms.push_back({ arg, std::vector<unsigned char>(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>()) });
+		}
+	}
+
+	if (!opt.frame || opt.frame > 0x7FFF || !opt.instructions) { return usage(); }
+	if (opt.backends.empty())
+		opt.backends = { BACKEND_SWITCH, BACKEND_TABLE, BACKEND_JIT, BACKEND_CACHED, BACKEND_AOT };
+	if (roms.empty())
+	{
+		roms.push_back({ "builtin", std::vector<unsigned char>(std::begin(builtinRom), std::end(builtinRom)) });
+		if (opt.diff) { roms.push_back(jitArenaRom()); }
+	}
+
+	if (opt.batch)
+	{
+		bool same = true;
+		for (auto& rom : roms)
+			same &= batchRom(rom, opt);
+		return same ? 0 : 1;
+	}
+
+	if (opt.poolMachines)
+	{
+		bool same = true;
+		for (auto& rom : roms)
+			same &= poolRom(rom, opt);
+		return same ? 0 : 1;
+	}
+
+	if (opt.diff)
+	{
+		bool same = true;
+		for (auto& rom : roms)
+			same &= diffRom(rom, opt);
+		return same ? 0 : 1;
+	}
+
+	std::unique_ptr<chip8TraceWriter> trace;
+	if (!tracePath.empty())
+	{
+		trace.reset(new chip8TraceWriter(tracePath.c_str()));
+		if (!trace->good())
+		{
+			std::fprintf(stderr, "can't write %s\n", tracePath.c_str());
+			return 1;
+		}
+		opt.trace = trace.get();
+	}
+
+	const double overhead = clockOverheadNs();
+
+	if (opt.json)
+	{
+		std::printf("{\n  \"instructions\": %llu, \"profiled\": %llu, \"frame\": %u, \"clockOverheadNs\": %.3f,\n"
+			"  \"roms\": [\n", opt.instructions, opt.profiled, opt.frame, overhead);
+	}
+
+	for (size_t i = 0; i < roms.size(); i++)
+	{
+		std::vector<benchResult> results(opt.backends.size());
+		for (size_t b = 0; b < results.size(); b++)
+		{
+			results[b].backend = opt.backends[b];
+			throughput(roms[i], opt, results[b], unsigned(i * results.size() + b));
+			profile(roms[i], opt, overhead, results[b]);
+		}
+
+		if (!opt.profileDir.empty()) { writeProfile(roms[i], opt); }
+
+		if (opt.json) { printJson(roms[i], results, i + 1 == roms.size()); }
+		else { printText(roms[i], results); }
+	}
+
+	if (opt.json) { std::printf("  ]\n}\n"); }
+
+	if (trace)
+	{
+		trace->close();
+		if (!trace->good())
+		{
+			std::fprintf(stderr, "can't write %s\n", tracePath.c_str());
+			return 1;
+		}
+		std::fprintf(stderr, "%s: %llu bytes\n", tracePath.c_str(), (unsigned long long)trace->bytes());
+	}
+	return 0;
+}
@@ -0,0 +1,115 @@
+#include <algorithm>
+#include <cstring>
+
+#include "chip8-aot.h"
+#include "chip8-cpu.h"
+
+static std::vector<const chip8AotModule*>& registry()
+{
+	// Built during static initialization, by the generated modules
+	static std::vector<const chip8AotModule*> modules;
+	return modules;
+}
+
+const std::vector<const chip8AotModule*>& chip8AotModules()
+{
+	return registry();
+}
+
+chip8AotRegistrar::chip8AotRegistrar(const chip8AotModule& m)
+{
+	registry().push_back(&m);
+}
+
+bool chip8AotModule::matches(const block& b, const unsigned char* memory) const
+{
+	return b.start >= 0x200 && b.end <= 0x200 + codeSize &&
+		std::memcmp(memory + b.start, code + (b.start - 0x200), b.end - b.start) == 0;
+}
+
+// Picks the module with the most blocks the RAM still holds
+// and makes those runnable
+void chip8::bindAot()
+{
+	if (!aotBlocks) { aotBlocks.reset(new const chip8AotModule::block*[0x1000]); }
+	std::fill_n(aotBlocks.get(), 0x1000, nullptr);
+	aotLow = aotHigh = 0;
+	aot = nullptr;
+
+	const chip8AotModule* best = nullptr;
+	size_t bestCount = 0;
+	for (auto m : chip8AotModules())
+	{
+		const auto count = size_t(std::count_if(m->blocks, m->blocks + m->blockCount,
+			[&](const chip8AotModule::block& b) { return m->matches(b, memory); }));
+		if (count > bestCount)
+		{
+			best = m;
+			bestCount = count;
+		}
+	}
+	if (!best) { return; }
+
+	aotLow = 0x1000;
+	for (size_t i = 0; i < best->blockCount; i++)
+	{
+		const auto& b = best->blocks[i];
+		if (!best->matches(b, memory)) { continue; }
+		aotBlocks[b.start] = &b;
+		aotLow = std::min<unsigned>(aotLow, b.start);
+		aotHigh = std::max<unsigned>(aotHigh, b.end);
+	}
+	aot = best;
+}
+
+// Stops running the blocks a store changed
+void chip8::dropAot(unsigned addr, unsigned len)
+{
+	const unsigned span = 2 * chip8AotModule::maxBlockLength + 2;
+	const unsigned first = std::max(aotLow, addr >= span ? addr - span : 0);
+	const unsigned last = std::min(aotHigh, addr + len);
+	for (unsigned s = first; s < last; s++)
+	{
+		const auto b = aotBlocks[s];
+		if (b && b->end > addr && !aot->matches(*b, memory))
+			aotBlocks[s] = nullptr;
+	}
+}
+
+// Same contract as emulateCycle, and the same loop as runJit
+bool chip8::runAot(short cycles, bool force)
+{
+	if (!aotBlocks) { bindAot(); }
+
+	// Nothing recompiled for this ROM
+	if (!aot) { return runTable(cycles, force); }
+
+	for (auto i = 0; i < cycles;)
+	{
+		if (!isRunning & !force) { break; }
+
+		// Blocks never trace, so tracing and profiling
+		// run everything through the interpreter
+		const auto from = pc;
+		const auto b = !observed() && pc < 0x1000 ? aotBlocks[pc] : nullptr;
+		if (b && b->count <= cycles - i)
+		{
+			b->fn(*this);
+			if (b->jumps && detInfLoop()) { return false; }
+			i += b->count;
+
+			// Looping back may be a spin loop
+			const unsigned last = from + 2 * (b->count - 1);
+			if (b->jumps && pc <= last && (memory[last] & 0xF0) == 0x10)
+				i += idleLoop(last, i, cycles - i);
+			continue;
+		}
+
+		if (!runTable(1, force)) { return false; }
+		i++;
+
+		if ((opcode & 0xF000) == 0x1000 && pc <= from)
+			i += idleLoop(from, i, cycles - i);
+	}
+	return true;
+}
@@ -0,0 +1,63 @@
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#ifndef AOT_H
+#define AOT_H
+
+#include <cstddef>
+#include <vector>
+
+#include "chip8-memory.h"
+
+// A ROM recompiled ahead of time into C++ by chip8-aot.
+//
+// Blocks follow chip8Jit's rules: a straight-line run of instructions
+// that ends with the first control flow instruction, or right before
+// anything left to the interpreter (DXYN, FX0A, CXNN, the key skips,
+// the sound timer, memory stores and everything past CHIP-8 but the
+// big font). Unlike the JIT's, they also read and set the delay timer
+// (FX07, FX15). chip8-aot only emits the blocks it can reach from 0x200
+// through jumps, calls, returns and skips. BACKEND_AOT runs them where
+// they start and the table interpreter everywhere else, e.g. after BNNN.
+//
+// The module keeps the bytes it was compiled from. A block only runs
+// while the RAM under it still holds them, so the module picks itself
+// for the matching ROM and self-modified code falls back as well.
+struct chip8AotModule
+{
+	// Runs the block on the machine state and leaves the next PC in it
+	typedef void (*blockFn)(chip8State& s);
+
+	struct block
+	{
+		unsigned short start;
+		unsigned short end;		//First address after the block, covers the
+								//instruction after a final skip like chip8Jit
+		unsigned short count;	//Instructions executed by one run
+		bool jumps;				//Ends in 1NNN
+		blockFn fn;
+	};
+
+	// Longest block chip8-aot emits, in instructions
+	static const unsigned maxBlockLength = 64;
+
+	const char* name;
+	const unsigned char* code;	//RAM from 0x200 on as the blocks expect it
+	size_t codeSize;
+	const block* blocks;		//Sorted by start
+	size_t blockCount;
+
+	// Whether the block can run on this RAM
+	bool matches(const block& b, const unsigned char* memory) const;
+};
+
+// Every module linked into the program. Generated modules add
+// themselves with a static chip8AotRegistrar.
+const std::vector<const chip8AotModule*>& chip8AotModules();
+
+struct chip8AotRegistrar
+{
+	explicit chip8AotRegistrar(const chip8AotModule& m);
+};
+#endif
@@ -0,0 +1,47 @@
+#include <algorithm>
+#include <cmath>
+
+#include "chip8-audio.h"
+#include "chip8-scheduler.h"
+
+chip8Audio::chip8Audio(unsigned rate)
+	: sampleRate(std::min<unsigned>(std::max(1u, rate), (maxTick - 1) * chip8Scheduler::timerHz))
+{
+	maxLatency = 3 * sampleRate / chip8Scheduler::timerHz;
+}
+
+void chip8Audio::renderTick(const chip8State& s)
+{
+	// 44100 and 48000 divide evenly, other rates carry the fraction
+	remainder += sampleRate;
+	const size_t n = remainder / chip8Scheduler::timerHz;
+	remainder %= chip8Scheduler::timerHz;
+
+	if (ring.size() + n > maxLatency) { return; }
+
+	if (!s.sound_timer)
+	{
+		std::fill_n(tick, n, int16_t(0));
+	}
+	else
+	{
+		// 4000 * 2^((pitch - 64) / 48) bits per second, one pattern is
+		// 128 bits. Computed once per tick, the loop only adds.
+		const double bitsPerSecond = 4000.0 * std::pow(2.0, (int(s.pitch) - 64) / 48.0);
+		const uint64_t step = uint64_t(bitsPerSecond / sampleRate * 4294967296.0);
+		for (size_t i = 0; i < n; i++)
+		{
+			const unsigned bit = unsigned(position >> 32) & 127;
+			tick[i] = (s.pattern[bit >> 3] >> (7 - (bit & 7)) & 1) ? amplitude : -amplitude;
+			position += step;
+		}
+	}
+	ring.push(tick, n);
+}
+
+size_t chip8Audio::read(int16_t* out, size_t n)
+{
+	const size_t got = ring.pop(out, n);
+	std::fill(out + got, out + n, int16_t(0));
+	return got;
+}
@@ -0,0 +1,56 @@
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "chip8-memory.h"
+#include "chip8-sync.h"
+
+// Synthesizes the buzzer in emulated time.
+//
+// Whoever ticks the timers calls renderTick() right before each tick,
+// which renders that 1/60s of sound into a lock-free ring: the machine's
+// 128-bit pattern (F002) played at its pitch (FX3A) while the sound
+// timer is above zero, silence otherwise. A plain CHIP-8 machine has a
+// square wave in its pattern. The sound lasts exactly as many samples as
+// the timer ran, however the host scheduled the emulation.
+//
+// The audio device thread read()s the samples back. Nothing on either
+// side allocates, locks or touches a file.
+class chip8Audio
+{
+public:
+	// Samples per second, mono
+	explicit chip8Audio(unsigned sampleRate = 44100);
+
+	unsigned rate() const { return sampleRate; }
+
+	// Emulation side, renders one timer tick of s. A tick is dropped
+	// when the reader is more than maxLatency samples behind, e.g. in turbo.
+	void renderTick(const chip8State& s);
+
+	// Audio side, fills out with n samples. Returns how many came from
+	// the machine, the rest (the emulation fell behind or is paused) is silence.
+	size_t read(int16_t* out, size_t n);
+
+	// Samples queued ahead of the reader before ticks are dropped,
+	// three ticks by default
+	size_t maxLatency;
+
+private:
+	static const size_t ringSize = 8192;	//Power of two, ~185ms at 44.1kHz
+	static const size_t maxTick = 4096;		//Samples of one tick at up to 245kHz
+	static const int16_t amplitude = 6000;
+
+	unsigned sampleRate;
+	unsigned remainder = 0;		//Fraction of a sample carried to the next tick, in 60ths
+	uint64_t position = 0;		//Playback position in the pattern, bits as 32.32 fixed point
+	int16_t tick[maxTick];		//One tick, rendered before it is queued
+	spscQueue<int16_t, ringSize> ring;
+};
+#endif
@@ -0,0 +1,536 @@
+#include <algorithm>
+#include <cstring>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "chip8-batch.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BATCH_SSE2 1
+#endif
+
+// 32 byte lanes, one AVX2 register, two SSE2 registers or a plain array
+namespace
+{
+#if defined(__AVX2__)
+	struct vec
+	{
+		__m256i v;
+
+		static vec load(const unsigned char* p) { return { _mm256_load_si256(reinterpret_cast<const __m256i*>(p)) }; }
+		static vec splat(unsigned char b) { return { _mm256_set1_epi8(char(b)) }; }
+		void store(unsigned char* p) const { _mm256_store_si256(reinterpret_cast<__m256i*>(p), v); }
+
+		friend vec operator+(vec a, vec b) { return { _mm256_add_epi8(a.v, b.v) }; }
+		friend vec operator-(vec a, vec b) { return { _mm256_sub_epi8(a.v, b.v) }; }
+		friend vec operator&(vec a, vec b) { return { _mm256_and_si256(a.v, b.v) }; }
+		friend vec operator|(vec a, vec b) { return { _mm256_or_si256(a.v, b.v) }; }
+		friend vec operator^(vec a, vec b) { return { _mm256_xor_si256(a.v, b.v) }; }
+		friend vec eq(vec a, vec b) { return { _mm256_cmpeq_epi8(a.v, b.v) }; }
+		friend vec maxu(vec a, vec b) { return { _mm256_max_epu8(a.v, b.v) }; }
+		friend vec subsu(vec a, vec b) { return { _mm256_subs_epu8(a.v, b.v) }; }
+		friend vec shr1(vec a) { return { _mm256_and_si256(_mm256_srli_epi16(a.v, 1), _mm256_set1_epi8(0x7F)) }; }
+		friend vec select(vec m, vec a, vec b) { return { _mm256_blendv_epi8(b.v, a.v, m.v) }; }
+
+		// Bit l of the mask <-> 0xFF/0x00 in lane l
+		static vec fromBits(uint32_t bits)
+		{
+			const __m256i spread = _mm256_setr_epi8(
+				0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+				2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+			const __m256i select = _mm256_set1_epi64x(0x8040201008040201LL);
+			const __m256i v = _mm256_shuffle_epi8(_mm256_set1_epi32(int(bits)), spread);
+			return { _mm256_cmpeq_epi8(_mm256_and_si256(v, select), select) };
+		}
+		uint32_t toBits() const { return uint32_t(_mm256_movemask_epi8(v)); }
+	};
+
+	// Lanes whose 16-bit value equals v
+	uint32_t match16(const unsigned short* p, unsigned short v)
+	{
+		const __m256i k = _mm256_set1_epi16(short(v));
+		const __m256i a = _mm256_cmpeq_epi16(_mm256_load_si256(reinterpret_cast<const __m256i*>(p)), k);
+		const __m256i b = _mm256_cmpeq_epi16(_mm256_load_si256(reinterpret_cast<const __m256i*>(p + 16)), k);
+		// packs works within 128-bit halves, the permute puts the lanes back in order
+		return uint32_t(_mm256_movemask_epi8(_mm256_permute4x64_epi64(_mm256_packs_epi16(a, b), 0xD8)));
+	}
+#elif defined(BATCH_SSE2)
+	struct vec
+	{
+		__m128i lo, hi;
+
+		static vec load(const unsigned char* p)
+		{
+			return { _mm_load_si128(reinterpret_cast<const __m128i*>(p)),
+			         _mm_load_si128(reinterpret_cast<const __m128i*>(p + 16)) };
+		}
+		static vec splat(unsigned char b) { return { _mm_set1_epi8(char(b)), _mm_set1_epi8(char(b)) }; }
+		void store(unsigned char* p) const
+		{
+			_mm_store_si128(reinterpret_cast<__m128i*>(p), lo);
+			_mm_store_si128(reinterpret_cast<__m128i*>(p + 16), hi);
+		}
+
+#define BATCH_OP(name, intrin) \
+		friend vec name(vec a, vec b) { return { intrin(a.lo, b.lo), intrin(a.hi, b.hi) }; }
+		BATCH_OP(operator+, _mm_add_epi8)
+		BATCH_OP(operator-, _mm_sub_epi8)
+		BATCH_OP(operator&, _mm_and_si128)
+		BATCH_OP(operator|, _mm_or_si128)
+		BATCH_OP(operator^, _mm_xor_si128)
+		BATCH_OP(eq, _mm_cmpeq_epi8)
+		BATCH_OP(maxu, _mm_max_epu8)
+		BATCH_OP(subsu, _mm_subs_epu8)
+#undef BATCH_OP
+		friend vec shr1(vec a)
+		{
+			const __m128i low7 = _mm_set1_epi8(0x7F);
+			return { _mm_and_si128(_mm_srli_epi16(a.lo, 1), low7), _mm_and_si128(_mm_srli_epi16(a.hi, 1), low7) };
+		}
+		friend vec select(vec m, vec a, vec b)
+		{
+			return { _mm_or_si128(_mm_and_si128(m.lo, a.lo), _mm_andnot_si128(m.lo, b.lo)),
+			         _mm_or_si128(_mm_and_si128(m.hi, a.hi), _mm_andnot_si128(m.hi, b.hi)) };
+		}
+
+		// Bit l of the mask <-> 0xFF/0x00 in lane l
+		static vec fromBits(uint32_t bits)
+		{
+			const __m128i select = _mm_set1_epi64x(0x8040201008040201LL);
+			__m128i v = _mm_cvtsi32_si128(int(bits));
+			v = _mm_unpacklo_epi8(v, v);
+			v = _mm_unpacklo_epi16(v, v);
+			const __m128i lo = _mm_unpacklo_epi32(v, v), hi = _mm_unpackhi_epi32(v, v);
+			return { _mm_cmpeq_epi8(_mm_and_si128(lo, select), select),
+			         _mm_cmpeq_epi8(_mm_and_si128(hi, select), select) };
+		}
+		uint32_t toBits() const { return uint32_t(_mm_movemask_epi8(lo)) | uint32_t(_mm_movemask_epi8(hi)) << 16; }
+	};
+
+	// Lanes whose 16-bit value equals v
+	uint32_t match16(const unsigned short* p, unsigned short v)
+	{
+		const __m128i k = _mm_set1_epi16(short(v));
+		uint32_t bits = 0;
+		for (int i = 0; i < 2; i++)
+		{
+			const __m128i a = _mm_cmpeq_epi16(_mm_load_si128(reinterpret_cast<const __m128i*>(p + 16 * i)), k);
+			const __m128i b = _mm_cmpeq_epi16(_mm_load_si128(reinterpret_cast<const __m128i*>(p + 16 * i + 8)), k);
+			bits |= uint32_t(_mm_movemask_epi8(_mm_packs_epi16(a, b))) << 16 * i;
+		}
+		return bits;
+	}
+#else
+	struct vec
+	{
+		unsigned char b[32];
+
+		static vec load(const unsigned char* p) { vec r; std::memcpy(r.b, p, 32); return r; }
+		static vec splat(unsigned char v) { vec r; std::memset(r.b, v, 32); return r; }
+		void store(unsigned char* p) const { std::memcpy(p, b, 32); }
+
+#define BATCH_OP(name, expr) \
+		friend vec name(vec a, vec c) { vec r; for (int i = 0; i < 32; i++) { r.b[i] = (unsigned char)(expr); } return r; }
+		BATCH_OP(operator+, a.b[i] + c.b[i])
+		BATCH_OP(operator-, a.b[i] - c.b[i])
+		BATCH_OP(operator&, a.b[i] & c.b[i])
+		BATCH_OP(operator|, a.b[i] | c.b[i])
+		BATCH_OP(operator^, a.b[i] ^ c.b[i])
+		BATCH_OP(eq, a.b[i] == c.b[i] ? 0xFF : 0)
+		BATCH_OP(maxu, std::max(a.b[i], c.b[i]))
+		BATCH_OP(subsu, a.b[i] > c.b[i] ? a.b[i] - c.b[i] : 0)
+#undef BATCH_OP
+		friend vec shr1(vec a) { vec r; for (int i = 0; i < 32; i++) { r.b[i] = a.b[i] >> 1; } return r; }
+		friend vec select(vec m, vec a, vec c) { vec r; for (int i = 0; i < 32; i++) { r.b[i] = m.b[i] ? a.b[i] : c.b[i]; } return r; }
+
+		static vec fromBits(uint32_t bits) { vec r; for (int i = 0; i < 32; i++) { r.b[i] = (bits >> i & 1) ? 0xFF : 0; } return r; }
+		uint32_t toBits() const { uint32_t bits = 0; for (int i = 0; i < 32; i++) { bits |= uint32_t(b[i] >> 7) << i; } return bits; }
+	};
+
+	uint32_t match16(const unsigned short* p, unsigned short v)
+	{
+		uint32_t bits = 0;
+		for (int i = 0; i < 32; i++)
+			bits |= uint32_t(p[i] == v) << i;
+		return bits;
+	}
+#endif
+
+	// Unsigned a >= b, as 0xFF/0x00 per lane
+	vec geu(vec a, vec b) { return eq(maxu(a, b), a); }
+
+	// Lanes in a group are bits of a 32-bit mask
+	unsigned lowestLane(uint32_t group)
+	{
+#ifdef _MSC_VER
+		unsigned long l;
+		_BitScanForward(&l, group);
+		return l;
+#else
+		return __builtin_ctz(group);
+#endif
+	}
+
+	unsigned laneCount(uint32_t group)
+	{
+#ifdef _MSC_VER
+		return __popcnt(group);
+#else
+		return __builtin_popcount(group);
+#endif
+	}
+
+	unsigned short nextPC(unsigned short pc) { return (pc + 2) & mem::pcMask; }
+}
+
+static_assert(chip8Batch::lanes == 32, "the vector code handles exactly 32 lanes");
+
+chip8Batch::chip8Batch()
+{
+	std::memset(static_cast<void*>(this), 0, sizeof *this);
+}
+
+void chip8Batch::load(unsigned lane, const chip8State& s)
+{
+	for (auto r = 0; r < 16; r++)
+	{
+		V[r][lane] = s.V[r];
+		stack[r][lane] = s.stack[r];
+	}
+	for (auto y = 0; y < 64 * 2; y++)
+		pixels[y][lane] = s.pixels[0][y];
+
+	delay_timer[lane] = s.delay_timer;
+	sound_timer[lane] = s.sound_timer;
+	I[lane] = s.I;
+	pc[lane] = s.pc;
+	sp[lane] = s.sp;
+	opcode[lane] = s.opcode;
+	rng[lane] = s.rng;
+	drawFlag[lane] = s.drawFlag;
+	status[lane] = s.waitForKey ? LANE_WAITING : LANE_RUNNING;
+	if (s.hires || s.planes != 1 || s.mode == MODE_XOCHIP)
+		status[lane] = LANE_STOPPED;
+
+	keys[lane] = 0;
+	for (auto k = 0; k < 16; k++)
+		keys[lane] |= s.key[k] << k;
+
+	std::memcpy(memory[lane], s.memory, sizeof memory[lane]);
+}
+
+void chip8Batch::store(unsigned lane, chip8State& s) const
+{
+	for (auto r = 0; r < 16; r++)
+	{
+		s.V[r] = V[r][lane];
+		s.stack[r] = stack[r][lane];
+	}
+	for (auto y = 0; y < 64 * 2; y++)
+		s.pixels[0][y] = pixels[y][lane];
+
+	s.delay_timer = delay_timer[lane];
+	s.sound_timer = sound_timer[lane];
+	s.I = I[lane];
+	s.pc = pc[lane];
+	s.sp = sp[lane];
+	s.opcode = opcode[lane];
+	s.rng = rng[lane];
+	s.drawFlag = drawFlag[lane];
+	s.waitForKey = status[lane] == LANE_WAITING;
+
+	for (auto k = 0; k < 16; k++)
+		s.key[k] = (keys[lane] >> k) & 1;
+
+	std::memcpy(s.memory, memory[lane], sizeof memory[lane]);
+}
+
+// Same as chip8::keyPress
+void chip8Batch::keyPress(unsigned lane, unsigned char k)
+{
+	keys[lane] |= 1 << k;
+	if (status[lane] == LANE_WAITING)
+	{
+		status[lane] = LANE_RUNNING;
+		V[(opcode[lane] & 0x0F00) >> 8][lane] = k;
+		pc[lane] = nextPC(pc[lane]);
+	}
+}
+
+void chip8Batch::keyRelease(unsigned lane, unsigned char k)
+{
+	keys[lane] &= ~(1 << k);
+}
+
+uint64_t chip8Batch::run(unsigned cycles)
+{
+	const decodedOp* const table = decodeTable();
+	uint64_t executed = 0;
+
+	// Every round runs one instruction on each running lane. Lanes are
+	// grouped by PC and opcode, so lanes that split up at a branch
+	// share vector steps again as soon as their paths rejoin.
+	for (unsigned c = 0; c < cycles; c++)
+	{
+		uint32_t pending = eq(vec::load(reinterpret_cast<const unsigned char*>(status)), vec::splat(LANE_RUNNING)).toBits();
+		if (!pending) { break; }
+
+		while (pending)
+		{
+			const unsigned first = lowestLane(pending);
+			const unsigned short at = pc[first];
+			const unsigned short op = fetch(first);
+
+			uint32_t group = match16(pc, at) & pending;
+
+			// Self-modifying code can put different
+			// instructions at the same address
+			for (uint32_t g = group; g; g &= g - 1)
+			{
+				const unsigned l = lowestLane(g);
+				if (fetch(l) == op)
+					opcode[l] = op;
+				else
+					group &= ~(1u << l);
+			}
+
+			execute(table[op], group, at);
+			stepCount++;
+			executed += laneCount(group);
+			pending &= ~group;
+		}
+	}
+	return executed;
+}
+
+// Same as chip8::tickTimers on every lane
+void chip8Batch::tickTimers()
+{
+	const vec one = vec::splat(1);
+	subsu(vec::load(delay_timer), one).store(delay_timer);
+	subsu(vec::load(sound_timer), one).store(sound_timer);
+}
+
+// Runs one instruction on every lane in group, all of them are at PC `at`
+void chip8Batch::execute(const decodedOp& d, uint32_t group, unsigned short at)
+{
+	const vec m = vec::fromBits(group);
+	const vec vx = vec::load(V[d.x]);
+	const vec vy = vec::load(V[d.y]);
+	alignas(32) unsigned char skip[lanes];
+
+	switch (d.kind)
+	{
+	case OP_LD_NN:	select(m, vec::splat(d.nn), vx).store(V[d.x]); break;
+	case OP_ADD_NN:	select(m, vx + vec::splat(d.nn), vx).store(V[d.x]); break;
+	case OP_LD_XY:	select(m, vy, vx).store(V[d.x]); break;
+	case OP_OR:		select(m, vx | vy, vx).store(V[d.x]); break;
+	case OP_AND:	select(m, vx & vy, vx).store(V[d.x]); break;
+	case OP_XOR:	select(m, vx ^ vy, vx).store(V[d.x]); break;
+
+	// VF is written first and VX/VY reloaded afterwards,
+	// so the results match decodeOpcode when X or Y is F
+	case OP_ADD_XY:
+	{
+		const vec vf = vec::load(V[0xF]);
+		select(m, (geu(vx + vy, vx) ^ vec::splat(0xFF)) & vec::splat(1), vf).store(V[0xF]);
+		const vec x2 = vec::load(V[d.x]), y2 = vec::load(V[d.y]);
+		select(m, x2 + y2, x2).store(V[d.x]);
+		break;
+	}
+	case OP_SUB:
+	{
+		const vec vf = vec::load(V[0xF]);
+		select(m, geu(vx, vy) & vec::splat(1), vf).store(V[0xF]);
+		const vec x2 = vec::load(V[d.x]), y2 = vec::load(V[d.y]);
+		select(m, x2 - y2, x2).store(V[d.x]);
+		break;
+	}
+	case OP_SUBN:
+	{
+		const vec vf = vec::load(V[0xF]);
+		select(m, geu(vy, vx) & vec::splat(1), vf).store(V[0xF]);
+		const vec x2 = vec::load(V[d.x]), y2 = vec::load(V[d.y]);
+		select(m, y2 - x2, x2).store(V[d.x]);
+		break;
+	}
+	case OP_SHR:
+	{
+		const vec vf = vec::load(V[0xF]);
+		select(m, vx & vec::splat(1), vf).store(V[0xF]);
+		const vec x2 = vec::load(V[d.x]);
+		select(m, shr1(x2), x2).store(V[d.x]);
+		break;
+	}
+	case OP_SHL:
+	{
+		const vec vf = vec::load(V[0xF]);
+		select(m, geu(vx, vec::splat(0x80)) & vec::splat(1), vf).store(V[0xF]);
+		const vec x2 = vec::load(V[d.x]);
+		select(m, x2 + x2, x2).store(V[d.x]);
+		break;
+	}
+
+	// Skips compute the condition for all lanes at once,
+	// then each lane picks one of the two possible PCs
+	case OP_SE_NN:	eq(vx, vec::splat(d.nn)).store(skip); goto skips;
+	case OP_SNE_NN:	(eq(vx, vec::splat(d.nn)) ^ vec::splat(0xFF)).store(skip); goto skips;
+	case OP_SE_XY:	eq(vx, vy).store(skip); goto skips;
+	case OP_SNE_XY:	(eq(vx, vy) ^ vec::splat(0xFF)).store(skip); goto skips;
+	skips:
+	{
+		const unsigned short next2 = nextPC(at), next4 = nextPC(next2);
+		for (uint32_t g = group; g; g &= g - 1)
+		{
+			const unsigned l = lowestLane(g);
+			pc[l] = skip[l] ? next4 : next2;
+
+			// Skipping F000 NNNN would take two more bytes, but
+			// lanes stop on XO-CHIP code anyway
+			if (skip[l] && memory[l][next2] == 0xF0 && memory[l][next2 + 1] == 0x00)
+				status[l] = LANE_STOPPED;
+		}
+		return;
+	}
+
+	case OP_JP:
+	{
+		// Every lane lands on the same address, only the infinite
+		// loop check (chip8::detInfLoop) needs each lane's RAM
+		for (uint32_t g = group; g; g &= g - 1)
+		{
+			const unsigned l = lowestLane(g);
+			pc[l] = d.nnn;
+			if ((0x1000 | d.nnn) == (memory[l][d.nnn] << 8 | memory[l][d.nnn + 1]))
+				status[l] = LANE_STOPPED;
+		}
+		return;
+	}
+
+	default:
+		for (uint32_t g = group; g; g &= g - 1)
+			executeLane(lowestLane(g), d);
+		return;
+	}
+
+	const unsigned short next = nextPC(at);
+	for (uint32_t g = group; g; g &= g - 1)
+		pc[lowestLane(g)] = next;
+}
+
+// Everything that isn't worth vectorizing, one lane at a time
+void chip8Batch::executeLane(unsigned lane, const decodedOp& d)
+{
+	unsigned short& PC = pc[lane];
+	unsigned short& SP = sp[lane];
+	unsigned short& i = I[lane];
+	unsigned char* const ram = memory[lane];
+	unsigned char& VX = V[d.x][lane];
+
+	switch (d.kind)
+	{
+	case OP_CLS:
+		for (auto y = 0; y < 32; y++)
+			pixels[y][lane] = 0;
+		drawFlag[lane] = true;
+		break;
+	case OP_RET:
+		SP = (SP - 1) & 0xF;
+		PC = stack[SP][lane] & mem::pcMask;
+		break;
+	case OP_CALL:
+		stack[SP][lane] = PC;
+		SP = (SP + 1) % 0xF;
+		PC = d.nnn;
+		return;
+	case OP_LD_I:
+		i = d.nnn;
+		break;
+	case OP_JP_V0:
+		PC = (d.nnn + V[0][lane]) & mem::pcMask;
+		return;
+	case OP_RND:
+		VX = chip8State::random(rng[lane]) & d.nn;
+		break;
+	case OP_DRW:
+		// DXY0 is SUPER-CHIP's 16x16 sprite
+		if (!d.n)
+		{
+			status[lane] = LANE_STOPPED;
+			return;
+		}
+		drawSprite(lane, VX, V[d.y][lane], d.n);
+		break;
+	case OP_SKP:
+	case OP_SKNP:
+		if ((VX < 16 && (keys[lane] >> VX & 1)) == (d.kind == OP_SKP))
+		{
+			PC = nextPC(PC);
+			if (ram[PC] == 0xF0 && ram[PC + 1] == 0x00) { status[lane] = LANE_STOPPED; }
+		}
+		break;
+	case OP_LD_VX_DT:
+		VX = delay_timer[lane];
+		break;
+	case OP_LD_K:
+		status[lane] = LANE_WAITING;
+		return;
+	case OP_LD_DT:
+		delay_timer[lane] = VX;
+		break;
+	case OP_LD_ST:
+		sound_timer[lane] = VX;
+		break;
+	case OP_ADD_I:
+		V[0xF][lane] = VX > mem::smallMask - i;
+		i = (i + VX) & mem::smallMask;
+		break;
+	case OP_LD_F:
+		i = VX * 5;
+		break;
+	case OP_BCD:
+	{
+		const unsigned char v = VX;
+		ram[i] = v / 100;
+		ram[i + 1] = v / 10 % 10;
+		ram[i + 2] = v % 100 % 10;
+		mem::syncMirror(ram, mem::smallMask, i, 3);
+		break;
+	}
+	case OP_STORE:
+		for (auto r = 0; r <= d.x; r++)
+			ram[i + r] = V[r][lane];
+		mem::syncMirror(ram, mem::smallMask, i, d.x + 1);
+		break;
+	case OP_LOAD:
+		for (auto r = 0; r <= d.x; r++)
+			V[r][lane] = ram[i + r];
+		break;
+	default:
+		status[lane] = LANE_STOPPED;
+		return;
+	}
+	PC = nextPC(PC);
+}
+
+// Same as chip8::drawSprite
+void chip8Batch::drawSprite(unsigned lane, unsigned char vx, unsigned char vy, unsigned short height)
+{
+	const unsigned short x = vx & 63;
+	const unsigned short y = vy & 31;
+	uint64_t collision = 0;
+
+	for (auto yline = 0; yline < height && y + yline < 32; yline++)
+	{
+		const uint64_t row = uint64_t(memory[lane][I[lane] + yline]) << 56 >> x;
+		collision |= pixels[y + yline][lane] & row;
+		pixels[y + yline][lane] ^= row;
+	}
+	V[0xF][lane] = collision != 0;
+	drawFlag[lane] = true;
+}
@@ -0,0 +1,91 @@
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <cstdint>
+
+#include "chip8-memory.h"
+#include "chip8-decode.h"
+
+// Runs up to 32 machines in lockstep, meant for many copies
+// of one ROM that only differ in their input.
+//
+// Registers, timers and framebuffers are stored lane by lane
+// (structure of arrays). A round runs one instruction on every lane.
+// Each step of it takes the lowest lane that hasn't run yet and
+// executes its instruction for every lane at the same PC with the
+// same opcode, the rest are masked out and wait for a later step.
+// ALU ops and skips use SSE2/AVX2, everything that touches
+// RAM, the stack or the screen runs lane by lane.
+//
+// Lanes follow chip8::decodeOpcode exactly, except that there
+// are no sound events.
+// Only the original CHIP-8 instructions and lo-res screen are
+// supported, a lane stops at any SUPER-CHIP or XO-CHIP opcode (DXY0
+// included), before executing it, and lanes loaded in hi-res, with
+// other planes or in XO-CHIP mode don't run.
+class chip8Batch
+{
+public:
+	static const unsigned lanes = 32;
+
+	chip8Batch();
+
+	// Copies a machine into a lane, or a lane back out. The first 4K
+	// of RAM and the first plane go back and forth, store() leaves what
+	// the batch doesn't model (resolution, planes, mode, flags, audio)
+	// alone in s.
+	void load(unsigned lane, const chip8State& s);
+	void store(unsigned lane, chip8State& s) const;
+
+	void keyPress(unsigned lane, unsigned char k);
+	void keyRelease(unsigned lane, unsigned char k);
+
+	// False once a lane hit an infinite loop or an unknown opcode,
+	// or when nothing was loaded into it
+	bool running(unsigned lane) const { return status[lane] == LANE_RUNNING || status[lane] == LANE_WAITING; }
+
+	// Runs every lane for up to `cycles` instructions, like
+	// chip8::emulateCycle. Returns the instructions executed by all lanes.
+	uint64_t run(unsigned cycles);
+
+	// Same as chip8::tickTimers on every lane
+	void tickTimers();
+
+	// Number of vector steps taken by run() so far, executed
+	// instructions divided by this is the average lane occupancy
+	uint64_t steps() const { return stepCount; }
+
+private:
+	enum laneStatus : unsigned char { LANE_EMPTY, LANE_RUNNING, LANE_WAITING, LANE_STOPPED };
+
+	alignas(32) unsigned char V[16][lanes];
+	alignas(32) unsigned char delay_timer[lanes];
+	alignas(32) unsigned char sound_timer[lanes];
+	alignas(32) unsigned short I[lanes];
+	alignas(32) unsigned short pc[lanes];
+	alignas(32) unsigned short sp[lanes];
+	alignas(32) unsigned short opcode[lanes];
+	alignas(32) unsigned short stack[16][lanes];
+	alignas(32) uint64_t pixels[64 * 2][lanes];
+	alignas(32) laneStatus status[lanes];
+	uint64_t rng[lanes];	//chip8State::rng
+	unsigned short keys[lanes];	//Bit k is set while key k is down
+	bool drawFlag[lanes];
+
+	// RAM is per lane as a whole, lanes mostly read it at
+	// different addresses so it gains nothing from interleaving.
+	// Each row is the 4K address space and its mirror, like chip8State.
+	unsigned char memory[lanes][mem::smallMask + 1 + mem::mirrorSize];
+
+	uint64_t stepCount = 0;
+
+	unsigned short fetch(unsigned lane) const { return memory[lane][pc[lane]] << 8 | memory[lane][pc[lane] + 1]; }
+	void execute(const decodedOp& d, uint32_t group, unsigned short at);
+	void executeLane(unsigned lane, const decodedOp& d);
+	void drawSprite(unsigned lane, unsigned char vx, unsigned char vy, unsigned short height);
+};
+#endif
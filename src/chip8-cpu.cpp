@@ -1,10 +1,26 @@
+#include <algorithm>
 #include <fstream>
-#include <sstream>
-#include <iomanip>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
 
 #include "chip8-cpu.h"
 #include "chip8-memory.h"
-#include "sfTextTools.h"
+#include "chip8-tracefile.h"
+
+// Used when no frontend is attached, swallows every event
+static chip8Events noEvents;
+
+chip8::chip8() : chip8State(), events(&noEvents)
+{
+}
+
+void chip8::setEvents(chip8Events* e)
+{
+	events = e ? e : &noEvents;
+}
 
 void chip8::initCpu()
 {
@@ -15,38 +31,52 @@ void chip8::initCpu()
 	sp = 0;
 	delay_timer = 0;
 	sound_timer = 0;
+	drawFlag = false;
+	waitForKey = false;
+	mode = MODE_CHIP8;
 }
 
 int chip8::initialize()
 {
 	initCpu();
 	initMem();
+	trace.clear();
+	flushDecoded();
 
-	//Buffer used for the opcode debugging text
-	std::fill_n(buf, 256, 0);
-	opcode_ss << std::hex << std::setfill('0') << std::uppercase;
-
-	//Load beep sound
-	if (!sound_buffer.loadFromFile("resources/sounds/beep.wav"))
-	{
-		//Couldn't load sound
-		return -1;
-	}
-
-	beep.setBuffer(sound_buffer);
 	return 0;
 }
 
 int chip8::loadGame(const char* name)
 {
 	std::ifstream game(name, std::ios::in | std::ios::binary | std::ios::ate);
-	std::streamsize size = game.tellg();
+	std::vector<char> data(size_t(std::max<std::streamsize>(game.tellg(), 0)));
 	game.seekg(0, std::ios::beg);
+	game.read(data.data(), data.size());
+
+	const std::string path(name);
+	const auto ext = path.substr(std::min(path.size(), path.find_last_of('.')));
+	chip8Mode m = MODE_CHIP8;
+	if (ext == ".sc8" || ext == ".SC8") { m = MODE_SCHIP; }
+	else if (ext == ".xo8" || ext == ".XO8") { m = MODE_XOCHIP; }
+
+	return loadRom(reinterpret_cast<const unsigned char*>(data.data()), size_t(game.gcount()), m);
+}
+
+int chip8::loadRom(const unsigned char* rom, size_t size, chip8Mode m)
+{
+	//Fill the memory with game data at location: 0x200 == 512.
+	//Everything after it is cleared, also the mirror the 4K
+	//modes keep at 0x1000 when the ROM is for XO-CHIP.
+	mode = m;
+	const size_t n = std::min<size_t>(size, addrMask() + 1 - 0x200);
+	std::fill(memory + 0x200, memory + sizeof memory, 0);
+	std::copy_n(rom, n, memory + 0x200);
+	mirror();
 
-	//Fill the memory with game data at location: 0x200 == 512
-	game.read(reinterpret_cast<char*>(mem::memory) + 0x200, size);
+	//Decoded code may be from the previous game
+	flushDecoded();
 
-	return int(game.gcount());
+	return int(n);
 }
 
 void chip8::keyPress(unsigned char k)
@@ -55,64 +85,205 @@ void chip8::keyPress(unsigned char k)
 		waitForKey = false;
 		isRunning = true;
 
-		mem::V[(opcode & 0x0F00) >> 8] = k;
-		mem::key[k] = true;
+		V[(opcode & 0x0F00) >> 8] = k;
+		key[k] = true;
 
 		advancePC();
 	}
 	else
 	{
-		mem::key[k] = true;
+		key[k] = true;
 	}
 }
 
 void chip8::keyRelease(const unsigned char k)
 {
-	mem::key[k] = false;
+	key[k] = false;
+}
+
+void chip8::setKeys(uint16_t keys)
+{
+	// One at a time, a press may end FX0A
+	for (unsigned char k = 0; k < 16; k++)
+	{
+		const bool down = (keys >> k) & 1;
+		if (down == key[k]) { continue; }
+		if (down) { keyPress(k); }
+		else { keyRelease(k); }
+	}
+}
+
+void chip8::setWriteTracking(bool on)
+{
+	tracked = on;
+	std::fill_n(writtenPages, sizeof writtenPages / sizeof *writtenPages, ~0ULL);
+}
+
+void chip8::clearWritten()
+{
+	std::fill_n(writtenPages, sizeof writtenPages / sizeof *writtenPages, 0);
+}
+
+void chip8::markWritten(unsigned addr, unsigned len)
+{
+	// Stores never run past the padding at the end of memory
+	for (unsigned page = addr >> 8; page <= (addr + len - 1) >> 8; page++)
+		writtenPages[page >> 6] |= 1ULL << (page & 63);
 }
 
-void chip8::advancePC()
+void chip8::saveState(chip8State& s) const
 {
-	// PC is 12-bit so we need to wrap around
-	pc = (pc + 2) % 0xFFF;
+	std::memcpy(&s, static_cast<const chip8State*>(this), sizeof s);
+}
+
+void chip8::loadState(const chip8State& s)
+{
+	const bool beeping = sound_timer != 0;
+	std::memcpy(static_cast<chip8State*>(this), &s, sizeof s);
+
+	// The RAM may hold different code now
+	flushDecoded();
+	if (tracked) { setWriteTracking(true); }
+
+	if (beeping != (sound_timer != 0))
+		events->sound(sound_timer != 0);
+	drawFlag = true;
 }
 
 // If this returns false, we need to stop the emulation
 bool chip8::emulateCycle(short cycles, bool force)
 {
+	//Timers and keys may have changed since the last call
+	for (auto& mark : idle)
+		mark.at = 0xFFFF;
+
+	if (backend == BACKEND_TABLE)
+		return runTable(cycles, force);
+	if (backend == BACKEND_JIT)
+		return runJit(cycles, force);
+	if (backend == BACKEND_CACHED)
+		return runCached(cycles, force);
+	if (backend == BACKEND_AOT)
+		return runAot(cycles, force);
+
+	//decodeOpcode can't turn tracing or profiling on or off
+	const bool observe = CHIP8_TRACE && observed();
+
 	for (auto i = 0; i < cycles; i++)
 	{
 		if (!isRunning & !force) { break; }
 
 		//Fetch opcode
-		opcode = mem::memory[pc] << 8 |
-			mem::memory[pc + 1];
+		opcode = memory[pc] << 8 |
+			memory[pc + 1];
+
+		if (observe) { recordBegin(); }
 
 		//Decode opcode
 		//If decodeOpcode returns false, return false
+		const auto from = pc;
 		if (decodeOpcode(opcode)) {}
 		else return false;
 
-		// Update timers
-		if (delay_timer > 0)
-			--delay_timer;
+		if (observe) { recordEnd(); }
 
-		if (sound_timer > 0)
-		{
-			if (sound_timer == 1)
-				appendText(&debugText, "BEEP!");
-				beep.play();
-			--sound_timer;
-		}
+		//Looping back may be a spin loop
+		if ((opcode & 0xF000) == 0x1000 && pc <= from)
+			i += idleLoop(from, i + 1, cycles - i - 1);
 	}
 	return true;
 }
 
+void chip8::recordBegin()
+{
+	pending.pc = pc;
+	pending.opcode = opcode;
+	pending.vx = V[(opcode & 0x0F00) >> 8];
+	pending.vy = V[(opcode & 0x00F0) >> 4];
+}
+
+void chip8::recordEnd()
+{
+	pending.next = pc;
+	pending.I = I;
+	pending.vxOut = V[(opcode & 0x0F00) >> 8];
+	pending.vf = V[0xF];
+	pending.sp = (unsigned char)sp;
+	if (tracing) { trace.push(pending); }
+	if (streaming) { traceStream->push(pending); }
+	if (profileOn) { profile->record(pending.pc, pending.opcode, pc); }
+}
+
+void chip8::setTraceStream(chip8TraceStream* s)
+{
+	traceStream = s;
+	streaming = s != nullptr;
+}
+
+void chip8::setProfiling(bool on)
+{
+	if (on)
+	{
+		if (profile) { profile->clear(); }
+		else { profile.reset(new chip8Profile); }
+	}
+	profileOn = on;
+}
+
+// The buzzer sounds as long as the sound timer is above zero,
+// so only tell the frontend when it crosses zero
+void chip8::setSoundTimer(unsigned char value)
+{
+	if (!sound_timer != !value)
+		events->sound(value != 0);
+	sound_timer = value;
+}
+
+// Called after a backward 1NNN at `from`, with the instructions executed
+// in this emulateCycle call so far and how many are still to go.
+//
+// If the machine is in the same state as the last time it took this jump,
+// and nothing in between stored to RAM or the flags (FX75), drew or used
+// rand(), then the loop went around once without any effect and will
+// keep doing exactly that: its only inputs, the timers and keys, change
+// between emulateCycle calls.
+// Returns how many instructions of such whole iterations can be skipped,
+// the state after them is the current one.
+int chip8::idleLoop(unsigned short from, int executed, int remaining)
+{
+	//Traces and profiles want to see every instruction. Nothing is
+	//left to skip on the last one, which also keeps the single steps
+	//runJit interprets from leaving marks.
+	if ((CHIP8_TRACE && observed()) || remaining <= 0) { return 0; }
+
+	auto& mark = idle[(from >> 1) & 3];
+	if (mark.at == from && mark.effects == effects && mark.I == I && mark.sp == sp &&
+		mark.delay == delay_timer && mark.sound == sound_timer &&
+		std::memcmp(mark.V, V, sizeof V) == 0 && std::memcmp(mark.stack, stack, sizeof stack) == 0)
+	{
+		const int length = executed - mark.executed;
+		const int skip = remaining / length * length;
+		mark.executed = executed + skip;
+		return skip;
+	}
+
+	mark.at = from;
+	mark.I = I;
+	mark.sp = sp;
+	std::memcpy(mark.V, V, sizeof V);
+	std::memcpy(mark.stack, stack, sizeof stack);
+	mark.delay = delay_timer;
+	mark.sound = sound_timer;
+	mark.effects = effects;
+	mark.executed = executed;
+	return 0;
+}
+
 bool chip8::detInfLoop() const
 {
-	if ((0x1000 | pc) == (mem::memory[pc] << 8 | mem::memory[(pc + 1) % 0x1000]))
+	if ((0x1000 | pc) == (memory[pc] << 8 | memory[pc + 1]))
 	{
-		appendText(&debugText, "Infinite loop detected, game stopped.");
+		events->message("Infinite loop detected, game stopped.");
 		return true;
 	}
 	return false;
@@ -120,32 +291,49 @@ bool chip8::detInfLoop() const
 
 bool chip8::decodeOpcode(unsigned short opcode)
 {
-	using namespace mem;	// We're gonna be using fields from mem:: a lot
-
-	std::fill_n(buf, 256, 0);
-
 	switch (opcode & 0xF000)
 	{
 	case 0x0000:
 		switch (opcode & 0x0FFF)
 		{
 		case 0x00E0: // Clear screen
-			sprintf_s(buf, 256, "Clear screen");
-			std::fill_n(pixels, 64 * 32, 0);
+			clearScreen();
 			advancePC(); break;
 		case 0x00EE: // Return from a subroutine
 			sp = (sp - 1) & 0xF;	// Stack size is 16 so wrap SP accordingly
-			pc = stack[sp] % 0xFFF;
+			pc = stack[sp] & mem::pcMask;
 			advancePC();
-			sprintf_s(buf, 256, "RET from subroutine before %03X, sp:%d", pc, sp);
 			break;
+		case 0x00FB: // (00FB) Scrolls the screen right by 4 pixels
+			scrollHorizontal(4);
+			advancePC(); break;
+		case 0x00FC: // (00FC) Scrolls the screen left by 4 pixels
+			scrollHorizontal(-4);
+			advancePC(); break;
+		case 0x00FD: // (00FD) Exits the interpreter
+			return exitProgram();
+		case 0x00FE: // (00FE) Switches to 64x32
+			setResolution(false);
+			advancePC(); break;
+		case 0x00FF: // (00FF) Switches to 128x64
+			setResolution(true);
+			advancePC(); break;
 		default:
-			goto uknown;
+			switch (opcode & 0x0FF0)
+			{
+			case 0x00C0: // (00CN) Scrolls the screen down by N rows
+				scrollVertical(opcode & 0x000F);
+				advancePC(); break;
+			case 0x00D0: // (00DN) Scrolls the screen up by N rows
+				scrollVertical(-(opcode & 0x000F));
+				advancePC(); break;
+			default:
+				goto uknown;
+			}
 		}
 		break;
 	case 0x1000: // (1NNN) Jumps to address NNN
 		pc = opcode & 0x0FFF;
-		sprintf_s(buf, 256, "Jump to %03X", pc);
 		if (detInfLoop())
 		{
 			return false;  // Infinite loop detected (game stopped execution)
@@ -155,25 +343,21 @@ bool chip8::decodeOpcode(unsigned short opcode)
 		stack[sp] = pc;		// Stack size is 16 so wrap SP accordingly
 		sp = (sp + 1) % 0xF;
 		pc = opcode & 0x0FFF;
-		sprintf_s(buf, 256, "CALL subroutine %03X, sp:%d", pc, sp-1);
 		break;
 	case 0x3000: // (3XNN) Skips the next instruction if VX equals NN
 	{
 		auto X = (opcode & 0x0F00) >> 8;
 		if (V[X] == (opcode & 0x00FF))
 		{
-			sprintf_s(buf, 256, "V%X == %02X, so skip", X, (opcode & 0x00FF));
-			advancePC();
+			skipNext();
 		}
-		else { sprintf_s(buf, 256, "V%X != %02X, so don't skip", X, (opcode & 0x00FF)); }
 		advancePC(); break;
 	}
 	case 0x4000: // (4XNN) Skips the next instruction if VX doesn't equal NN
 		if (V[(opcode & 0x0F00) >> 8] != (opcode & 0x00FF))
 		{
-			sprintf_s(buf, 256, "V%X != %02X, so skip", (opcode & 0x0F00) >> 8, (opcode & 0x00FF));
-			advancePC();
-		} else { sprintf_s(buf, 256, "V%X == %02X, so don't skip", (opcode & 0x0F00) >> 8, (opcode & 0x00FF)); }
+			skipNext();
+		}
 		advancePC(); break;
 	case 0x5000:
 		switch (opcode & 0x000F)
@@ -181,39 +365,38 @@ bool chip8::decodeOpcode(unsigned short opcode)
 		case 0x0000: // (5XN0) Skips the next instruction if VX equals VY
 			if (V[(opcode & 0x0F00) >> 8] == V[(opcode & 0x00F0) >> 4])
 			{
-				sprintf_s(buf, 256, "V%X == V%X, so skip", (opcode & 0x0F00) >> 8, (opcode & 0x00F0) >> 4);
-				advancePC();
-			} else { sprintf_s(buf, 256, "V%X != V%X, so don't skip", (opcode & 0x0F00) >> 8, (opcode & 0x00F0) >> 4); }
+				skipNext();
+			}
+			advancePC(); break;
+		case 0x0002: // (5XY2) Stores VX to VY in memory starting at address I
+			storeRange((opcode & 0x0F00) >> 8, (opcode & 0x00F0) >> 4);
+			advancePC(); break;
+		case 0x0003: // (5XY3) Fills VX to VY with values from memory starting at address I
+			loadRange((opcode & 0x0F00) >> 8, (opcode & 0x00F0) >> 4);
 			advancePC(); break;
 		default:
 			goto uknown;
 		}
 		break;
 	case 0x6000: // (6XNN) Sets VX to NN
-		sprintf_s(buf, 256, "V%X = %02X", (opcode & 0x0F00) >> 8, (opcode & 0x00FF));
 		V[(opcode & 0x0F00) >> 8] = (opcode & 0x00FF);
 		advancePC(); break;
 	case 0x7000: // (7XNN) Adds NN to VX.
-		sprintf_s(buf, 256, "V%X += %02X", (opcode & 0x0F00) >> 8, (opcode & 0x00FF));
 		V[(opcode & 0x0F00) >> 8] += (opcode & 0x00FF);
 		advancePC(); break;
 	case 0x8000:
 		switch (opcode & 0x000F)
 		{
 		case 0x0000: // (8XY0) Sets VX to the value of VY.
-			sprintf_s(buf, 256, "V%X = V%X", (opcode & 0x0F00) >> 8, (opcode & 0x00F0) >> 4);
 			V[(opcode & 0x0F00) >> 8] = V[(opcode & 0x00F0) >> 4];
 			advancePC(); break;
 		case 0x0001: // (8XY1) Sets VX to VX or VY.
-			sprintf_s(buf, 256, "V%X |= V%X", (opcode & 0x0F00) >> 8, (opcode & 0x00F0) >> 4);
 			V[(opcode & 0x0F00) >> 8] |= V[(opcode & 0x00F0) >> 4];
 			advancePC(); break;
 		case 0x0002: // (8XY2) Sets VX to VX and VY.
-			sprintf_s(buf, 256, "V%X &= V%X", (opcode & 0x0F00) >> 8, (opcode & 0x00F0) >> 4);
 			V[(opcode & 0x0F00) >> 8] &= V[(opcode & 0x00F0) >> 4];
 			advancePC(); break;
 		case 0x0003: // (8XY3) Sets VX to VX xor VY.
-			sprintf_s(buf, 256, "V%X ^= V%X", (opcode & 0x0F00) >> 8, (opcode & 0x00F0) >> 4);
 			V[(opcode & 0x0F00) >> 8] ^= V[(opcode & 0x00F0) >> 4];
 			advancePC(); break;
 		case 0x0004: // (8XY4) Adds VY to VX. VF is set to 1 when there's a carry,
@@ -221,7 +404,6 @@ bool chip8::decodeOpcode(unsigned short opcode)
 			if (V[(opcode & 0x00F0) >> 4] > (0xFF - V[(opcode & 0x0F00) >> 8]))
 				V[0xF] = 1; //carry
 			else { V[0xF] = 0; }
-			sprintf_s(buf, 256, "V%X += V%X, carry=%d", (opcode & 0x0F00) >> 8, (opcode & 0x00F0) >> 4, V[0xF]);
 			V[(opcode & 0x0F00) >> 8] += V[(opcode & 0x00F0) >> 4];
 			advancePC(); break;
 		case 0x0005: // (8XY5) VY is subtracted from VX. VF is set to 0 when there's a borrow,
@@ -229,27 +411,23 @@ bool chip8::decodeOpcode(unsigned short opcode)
 			if (V[(opcode & 0x00F0) >> 4] > (V[(opcode & 0x0F00) >> 8]))
 				V[0xF] = 0; //borrow
 			else { V[0xF] = 1;}
-			sprintf_s(buf, 256, "V%X -= V%X, carry=%d", (opcode & 0x0F00) >> 8, (opcode & 0x00F0) >> 4, V[0xF]);
 			V[(opcode & 0x0F00) >> 8] -= V[(opcode & 0x00F0) >> 4];
 			advancePC(); break;
 		case 0x0006: // (8XY6) Shifts VX right by one. 
 					 // VF is set to the value of the least significant bit of VX before the shift
 			V[0xF] = V[(opcode & 0x0F00) >> 8] & 1;
 			V[(opcode & 0x0F00) >> 8] >>= 1;
-			sprintf_s(buf, 256, "V%X >>= 1, VF=%X", (opcode & 0x0F00) >> 8, V[0xF]);
 			advancePC(); break;
 		case 0x0007: // (8XY7) Sets VX to VY minus VX. VF is set to 0 when there's a borrow,
 					 // and 1 when there isn't
 			if (V[(opcode & 0x00F0) >> 4] < (V[(opcode & 0x0F00) >> 8]))
 				V[0xF] = 0; //borrow
 			else { V[0xF] = 1; }
-			sprintf_s(buf, 256, "V%X -= V%X, carry=%d", (opcode & 0x0F00) >> 8, (opcode & 0x00F0) >> 4, V[0xF]);
 			V[(opcode & 0x0F00) >> 8] = V[(opcode & 0x00F0) >> 4] - V[(opcode & 0x0F00) >> 8];
 			advancePC(); break;
 		case 0x000E: // (8XYE) Shifts VX left by one. 
 					 // VF is set to the value of the most significant bit of VX before the shift
 			V[0xF] = (V[(opcode & 0x0F00) >> 8] >> 7) & 1;
-			sprintf_s(buf, 256, "V%X <<= 1, VF=%X", (opcode & 0x0F00) >> 8, V[0xF]);
 			V[(opcode & 0x0F00) >> 8] <<= 1;
 			advancePC(); break;
 		default:
@@ -259,67 +437,25 @@ bool chip8::decodeOpcode(unsigned short opcode)
 	case 0x9000: // (9XY0) Skips the next instruction if VX doesn't equal VY.
 		if (V[(opcode & 0x0F00) >> 8] != V[(opcode & 0x00F0) >> 4])
 		{
-			sprintf_s(buf, 256, "V%X != VF=%X, so skip", (opcode & 0x0F00) >> 8, (opcode & 0x00F0) >> 4);
-			advancePC();
-		} else { sprintf_s(buf, 256, "V%X == V%X=%X, so don't skip",(opcode & 0x0F00) >> 8,
-											 (opcode & 0x00F0) >> 4, (opcode & 0x00F0) >> 4); }
+			skipNext();
+		}
 		advancePC(); break;
 	case 0xA000: // (ANNN) Sets I to the address NNN
 		I = opcode & 0x0FFF;
-		sprintf_s(buf, 256, "I = %03X", I);
 		advancePC(); break;
 	case 0xB000: // (BNNN) Jumps to the address NNN plus V0.
-		pc = (opcode & 0x0FFF) + V[0x0];
-		sprintf_s(buf, 256, "Jump to %03X + V0 = %04X", (opcode & 0x0FFF), (opcode & 0x0FFF) + V[0x0]);
+		pc = ((opcode & 0x0FFF) + V[0x0]) & mem::pcMask;
 		break;
 	case 0xC000: // (CXNN) Sets VX to the result of a bitwise and operation
 				 // on a random number and NN.
-		V[(opcode & 0x0F00) >> 8] = (rand() & 0x00FF) & (opcode & 0x00FF);
-		sprintf_s(buf, 256, "Randomizing V%X", (opcode & 0x0F00) >> 8);
+		V[(opcode & 0x0F00) >> 8] = random(rng) & (opcode & 0x00FF);
+		effects++;
 		advancePC(); break;
 	case 0xD000: // (DXYN) Draws a sprite at coordinate (VX, VY) 
-	{			 // that has a width of 8 pixels and a height of N pixels.
-		unsigned short x = V[(opcode & 0x0F00) >> 8] & WIDTH_PIXELS-1;
-		unsigned short y = V[(opcode & 0x00F0) >> 4] & HEIGHT_PIXELS-1;
-		unsigned short height = opcode & 0x000F;
-		unsigned short pixel;
-		/*
-		if (x >= WIDTH_PIXELS | y >= HEIGHT_PIXELS) // Invalid draw position given
-		{
-			sprintf_s(buf, 256, "Invalid position, X:%d, Y:%d", x, y);
-			//isRunning = false;
-		}
-		else
-		{
-			sprintf_s(buf, 256, "Drawing in X:%d, Y:%d, height:%d", x, y, height);
-		}
-		*/
-		sprintf_s(buf, 256, "Drawing in X:%d, Y:%d, height:%d", x, y, height);
-
-		V[0xF] = 0;
-		for (auto yline = 0; yline < height; yline++)
-		{
-			pixel = memory[I + yline];
-			for (auto xline = 0; xline < 8; xline++)
-			{
-				if ((pixel & (0x80 >> xline)) != 0)
-				{
-					if (pixels[(x + xline + ((y + yline) * 64))] == 1)
-						V[0xF] = 1;
-					pixels[x + xline + ((y + yline) * 64)] ^= 1;
-				}
-			}
-		}
-		first2bytes = (last2opcodes & 0xFFFF);
-		second2bytes = (last2opcodes & 0xFFFF0000) >> 16;
-		drawFlag = ((first2bytes==opcode) || (second2bytes == opcode));
-
-		last2opcodes <<= 16;
-		last2opcodes |= opcode;
-
-		drawFlag = true;
+				 // that has a width of 8 pixels and a height of N pixels.
+				 // (DXY0) draws a 16x16 sprite instead.
+		drawSprite(V[(opcode & 0x0F00) >> 8], V[(opcode & 0x00F0) >> 4], opcode & 0x000F);
 		advancePC(); break;
-	}
 	case 0xE000:
 	{
 		auto X = (opcode & 0x0F00) >> 8;
@@ -327,20 +463,16 @@ bool chip8::decodeOpcode(unsigned short opcode)
 		switch (opcode & 0x00FF)
 		{
 		case 0x009E: // (EX9E) Skips the next instruction if the key stored in VX is pressed.
-			if (key[V[X]])
+			if (keyDown(V[X]))
 			{
-				sprintf_s(buf, 256, "Key in V%X is pressed, so skip", X);
-				advancePC();
+				skipNext();
 			}
-			else { sprintf_s(buf, 256, "Key in V%X is not pressed, so don't skip", X); }
 			advancePC(); break;
 		case 0x00A1: // (EX9E) Skips the next instruction if the key stored in VX isn't pressed.
-			if (!key[V[X]])
+			if (!keyDown(V[X]))
 			{
-				sprintf_s(buf, 256, "Key in V%X is not pressed, so skip", X);
-				advancePC();
+				skipNext();
 			}
-			else { sprintf_s(buf, 256, "Key in V%X is pressed, so don't skip", X); }
 			advancePC(); break;
 		default:
 			goto uknown;
@@ -351,28 +483,39 @@ bool chip8::decodeOpcode(unsigned short opcode)
 	{
 		auto X = (opcode & 0x0F00) >> 8;
 
+		switch (opcode)
+		{
+		case 0xF000: // (F000 NNNN) Sets I to the 16-bit address NNNN
+			I = wrapI(memory[pc + 2] << 8 | memory[pc + 3]);
+			advancePC();
+			advancePC(); goto ret;
+		case 0xF002: // (F002) Loads the 16 byte audio pattern from I
+			std::copy_n(memory + I, 16, pattern);
+			advancePC(); goto ret;
+		}
+
 		switch (opcode & 0x00FF)
 		{
+		case 0x0001: // (FN01) Selects the bitplanes N for drawing and scrolling
+			if (X > 3) { goto uknown; }
+			planes = (unsigned char)X;
+			advancePC(); goto ret;
 		case 0x0007: // (FX07) Sets VX to the value of the delay timer.
 			V[X] = delay_timer;
-			sprintf_s(buf, 256, "V%X = delay_timer = %d", X, delay_timer);
 			advancePC(); goto ret;
 		case 0x000A: // TODO: (FX0A) A key press is awaited, and then stored in VX.
-			sprintf_s(buf, 256, "Waiting for key to be stored in V%X", X);
 			waitForKey = true;
 			isRunning = false;
 			goto ret;
 		case 0x0015: // (FX15) Sets the delay timer to VX.
-			sprintf_s(buf, 256, "delay_timer = V%X = %02X", delay_timer, X, V[X]);
 			delay_timer = V[X];
 			advancePC(); goto ret;
 		case 0x0018: // (FX18) Sets the sound timer to VX.
-			sprintf_s(buf, 256, "sound_timer = V%X = %02X", sound_timer, X, V[X]);
-			sound_timer = V[X];
+			setSoundTimer(V[X]);
 			advancePC(); goto ret;
 		case 0x001E: // (FX1E) Adds VX to I. VF is set to 1 when there's a carry,
 					 // and to 0 when there isn't
-			if (V[X] > (0xFFF - I))
+			if (V[X] > (maxI() - I))
 			{
 				V[0xF] = 1; //carry
 			}
@@ -380,31 +523,34 @@ bool chip8::decodeOpcode(unsigned short opcode)
 			{
 				V[0xF] = 0;
 			}
-			I = (I + V[X]) % 0xFFF;	// I is 12-bit so we need to wrap around
-			sprintf_s(buf, 256, "I += V%X, carry=%d", X, V[0xF]);
+			I = wrapI(I + V[X]);	// I is 12-bit (16 on XO-CHIP) so we need to wrap around
 			advancePC(); goto ret;
 		case 0x0029: // (FX29) Sets I to the location of the sprite for the character in VX
 					 // Characters 0 - F(in hexadecimal) are represented by a 4x5 font.
 			I = V[X] * 5;
-			sprintf_s(buf, 256, "I = %03X (loc of sprite for char %X)", I, X);
+			advancePC(); goto ret;
+		case 0x0030: // (FX30) Sets I to the 8x10 sprite for the digit in VX
+			I = mem::bigFontAddr + (V[X] & 0xF) * 10;
 			advancePC(); goto ret;
 		case 0x0033: // (FX33) Stores the binary-coded decimal representation of
 		{			 // VX at the addresses I, I plus 1, and I plus 2
 			auto VX = V[X];
 			memory[I] = VX / 100;
-			memory[(I + 1) % 0xFFF] = VX / 10 % 10;
-			memory[(I + 2) % 0xFFF] = VX % 100 % 10;
-			sprintf_s(buf, 256, "mem[I] = BCD(V%X), VX is %X, so changing memory to %X, %X, %X",
-				X, VX, memory[I], memory[I + 1], memory[I + 2]);
+			memory[I + 1] = VX / 10 % 10;
+			memory[I + 2] = VX % 100 % 10;
+			wrote(I, 3);
 			advancePC(); goto ret;
 		}
+		case 0x003A: // (FX3A) Sets the audio pattern's playback rate to VX
+			pitch = V[X];
+			advancePC(); goto ret;
 		case 0x0055: // (FX55) Stores V0 to VX in memory starting at address I
 		{
 			for (auto i = 0; i <= X; i++)
 			{
 				memory[I + i] = V[i];
 			}
-			sprintf_s(buf, 256, "Store V0 to V%X starting at I=%03X", X, I);
+			wrote(I, X + 1);
 			advancePC(); goto ret;
 		}
 		case 0x0065: // (FX65) Fills V0 to VX with values from memory starting at address I
@@ -413,30 +559,275 @@ bool chip8::decodeOpcode(unsigned short opcode)
 			{
 				V[i] = memory[I + i];
 			}
-			sprintf_s(buf, 256, "Fill V0 to V%X with values from I=%03X", X, I);
 			advancePC(); goto ret;
 		}
+		case 0x0075: // (FX75) Stores V0 to VX in the user flags
+			effects++;
+			std::copy_n(V, X + 1, flags);
+			advancePC(); goto ret;
+		case 0x0085: // (FX85) Fills V0 to VX from the user flags
+			std::copy_n(flags, X + 1, V);
+			advancePC(); goto ret;
 		default:
 			goto uknown;
 		}
 	}
 	default:
 		uknown:
-		opcode_ss.str("");
-		opcode_ss << "Unknown opcode: 0x" << std::setw(4) << opcode;
-
-		appendText(&debugText, &opcode_ss);
+		unknownOpcode(opcode);
 		return false; // We can't handle this opcode, so stop the emulation
 	}
 	ret: //The opcode is known, so exit the function normally
-	opcode_ss.str("");
-	opcode_ss << '(' << std::setw(4) << opcode << "): " << buf;
-	appendText(&debugText, &opcode_ss);
 	return true;
 }
 
+void chip8::flushDecoded()
+{
+	if (jit) { jit->flush(); }
+	if (icache)
+	{
+		for (auto a = 0; a < 0x1000; a++)
+			icache[a].kind = OP_UNDECODED;
+	}
+	if (aotBlocks) { bindAot(); }
+}
+
+// A store ran on past the end of the address space, the part that
+// landed in the mirror is moved to the start and the mirror updated
+void chip8::syncMirror(unsigned addr, unsigned len)
+{
+	const unsigned wrapped = mem::syncMirror(memory, addrMask(), addr, len);
+	if (!wrapped) { return; }
+	if (icache || jit || aotBlocks) { invalidate(0, wrapped); }
+	if (tracked) { markWritten(0, wrapped); }
+}
+
+void chip8::invalidate(unsigned addr, unsigned len)
+{
+	if (jit) { jit->invalidate(addr, len); }
+	if (icache)
+	{
+		// An instruction also covers the byte after its address,
+		// a fused one up to two more instructions after it
+		for (auto a = addr >= 5 ? addr - 5 : 0; a < addr + len && a < 0x1000; a++)
+			icache[a].kind = OP_UNDECODED;
+	}
+	if (aotBlocks && addr < aotHigh && addr + len > aotLow) { dropAot(addr, len); }
+}
+
+// Shared by all backends so they draw identically
+void chip8::drawSprite(unsigned char vx, unsigned char vy, unsigned short height)
+{
+	effects++;
+	drawFlag = true;
+
+	// Anything but an 8 pixel wide lo-res sprite on the first plane
+	if (hires | (planes != 1) | !height)
+	{
+		drawExtended(vx, vy, height);
+		return;
+	}
+
+	unsigned short x = vx & (WIDTH_PIXELS - 1);
+	unsigned short y = vy & (HEIGHT_PIXELS - 1);
+	uint64_t collision = 0;
+
+	// Each sprite row is shifted into place and XORed with a whole
+	// screen row. Columns past the right edge fall off the end of the
+	// shift and rows past the bottom are skipped, so sprites are clipped.
+	for (auto yline = 0; yline < height && y + yline < HEIGHT_PIXELS; yline++)
+	{
+		const uint64_t row = uint64_t(memory[I + yline]) << 56 >> x;
+		collision |= pixels[0][y + yline] & row;
+		pixels[0][y + yline] ^= row;
+	}
+	V[0xF] = collision != 0;
+}
+
+// Hi-res, 16x16 (DXY0) and multi-plane sprites. Every selected plane
+// takes the next sprite from I on, so two planes read twice the data.
+void chip8::drawExtended(unsigned char vx, unsigned char vy, unsigned short n)
+{
+	const bool wide = n == 0;
+	const unsigned rows = wide ? 16 : n;
+	const unsigned x = vx & (width() - 1);
+	const unsigned y = vy & (height() - 1);
+	unsigned addr = I;
+	unsigned hit = 0, clipped = 0;	//Bit r: sprite row r collided / fell off the bottom
+
+	for (unsigned p = 0; p < 2; p++)
+	{
+		if (!(planes >> p & 1)) { continue; }
+
+		for (unsigned r = 0; r < rows; r++)
+		{
+			// A sprite row as the top 16 bits of a word
+			const unsigned bits = wide
+				? memory[addr + 2 * r] << 8 | memory[addr + 2 * r + 1]
+				: memory[addr + r] << 8;
+			const uint64_t row = uint64_t(bits) << 48;
+
+			if (y + r >= height())
+			{
+				clipped |= 1u << r;
+				continue;
+			}
+
+			uint64_t collision;
+			if (hires)
+			{
+				// Two words per row, the sprite may straddle them
+				uint64_t* const line = &pixels[p][2 * (y + r)];
+				const uint64_t left = x < 64 ? row >> x : 0;
+				const uint64_t right = x < 64 ? (x > 48 ? row << (64 - x) : 0) : row >> (x - 64);
+				collision = (line[0] & left) | (line[1] & right);
+				line[0] ^= left;
+				line[1] ^= right;
+			}
+			else
+			{
+				const uint64_t shifted = row >> x;
+				collision = pixels[p][y + r] & shifted;
+				pixels[p][y + r] ^= shifted;
+			}
+			if (collision) { hit |= 1u << r; }
+		}
+		addr += wide ? 32 : rows;
+	}
+
+	// SUPER-CHIP reports how many rows collided or were clipped in hi-res
+	if (mode == MODE_SCHIP && hires)
+	{
+		unsigned count = 0;
+		for (auto bits = hit | clipped; bits; bits &= bits - 1)
+			count++;
+		V[0xF] = (unsigned char)count;
+	}
+	else
+	{
+		V[0xF] = hit != 0;
+	}
+}
+
+// Clears the selected planes (00E0)
+void chip8::clearScreen()
+{
+	for (unsigned p = 0; p < 2; p++)
+	{
+		if (planes >> p & 1)
+			std::fill_n(pixels[p], hires ? 2 * HIRES_HEIGHT_PIXELS : HEIGHT_PIXELS, 0);
+	}
+	drawFlag = true;
+}
+
+// 00FE / 00FF, both clear every plane
+void chip8::setResolution(bool high)
+{
+	hires = high;
+	std::fill_n(&pixels[0][0], 2 * 64 * 2, 0);
+	drawFlag = true;
+}
+
+// Moves the selected planes down (rows > 0) or up, whole
+// words at a time. The rows scrolled in are blank.
+void chip8::scrollVertical(int rows)
+{
+	const int words = hires ? 2 : 1;
+	const int total = int(height()) * words;
+	const int shift = std::min(std::abs(rows) * words, total);
+
+	for (unsigned p = 0; p < 2; p++)
+	{
+		if (!(planes >> p & 1)) { continue; }
+
+		uint64_t* const screen = pixels[p];
+		if (rows > 0)
+		{
+			std::copy_backward(screen, screen + total - shift, screen + total);
+			std::fill_n(screen, shift, 0);
+		}
+		else
+		{
+			std::copy(screen + shift, screen + total, screen);
+			std::fill_n(screen + total - shift, shift, 0);
+		}
+	}
+	effects++;
+	drawFlag = true;
+}
+
+// Moves the selected planes right (columns > 0) or left by up to 63 pixels.
+// In hi-res the bits leaving one half of a row enter the other.
+void chip8::scrollHorizontal(int columns)
+{
+	const unsigned n = unsigned(std::abs(columns));
+
+	for (unsigned p = 0; p < 2; p++)
+	{
+		if (!(planes >> p & 1)) { continue; }
+
+		uint64_t* const screen = pixels[p];
+		if (!hires)
+		{
+			for (unsigned y = 0; y < HEIGHT_PIXELS; y++)
+				screen[y] = columns > 0 ? screen[y] >> n : screen[y] << n;
+		}
+		else if (columns > 0)
+		{
+			for (unsigned y = 0; y < 2 * HIRES_HEIGHT_PIXELS; y += 2)
+			{
+				screen[y + 1] = screen[y + 1] >> n | screen[y] << (64 - n);
+				screen[y] >>= n;
+			}
+		}
+		else
+		{
+			for (unsigned y = 0; y < 2 * HIRES_HEIGHT_PIXELS; y += 2)
+			{
+				screen[y] = screen[y] << n | screen[y + 1] >> (64 - n);
+				screen[y + 1] <<= n;
+			}
+		}
+	}
+	effects++;
+	drawFlag = true;
+}
+
+// 5XY2, counts down from X to Y when Y is lower. I doesn't move.
+void chip8::storeRange(unsigned x, unsigned y)
+{
+	const int step = x <= y ? 1 : -1;
+	const unsigned count = (x <= y ? y - x : x - y) + 1;
+	for (unsigned i = 0; i < count; i++)
+		memory[I + i] = V[x + step * int(i)];
+	wrote(I, count);
+}
+
+// 5XY3, the reverse of storeRange
+void chip8::loadRange(unsigned x, unsigned y)
+{
+	const int step = x <= y ? 1 : -1;
+	const unsigned count = (x <= y ? y - x : x - y) + 1;
+	for (unsigned i = 0; i < count; i++)
+		V[x + step * int(i)] = memory[I + i];
+}
+
+// 00FD, the program is done. Returns false like every other stop.
+bool chip8::exitProgram()
+{
+	events->message("Exit instruction, game stopped.");
+	return false;
+}
+
+void chip8::unknownOpcode(unsigned short opcode) const
+{
+	char msg[32];
+	snprintf(msg, sizeof msg, "Unknown opcode: 0x%04X", opcode);
+	events->message(msg);
+}
+
 void chip8::stopEmulation()
 {
 	isRunning = false;
-	appendText(&debugText, "Emulation stopped");
+	events->message("Emulation stopped");
 }
@@ -2,55 +2,196 @@
 #pragma once
 #endif
 
-#include <SFML/Audio/SoundBuffer.hpp>
-#include <SFML/Audio/Sound.hpp>
+#include <cstddef>
+#include <memory>
+
+#include "chip8-aot.h"
+#include "chip8-events.h"
+#include "chip8-trace.h"
+#include "chip8-profile.h"
+#include "chip8-jit.h"
+#include "chip8-decode.h"
+#include "chip8-memory.h"
 
 #ifndef CPU_H
 #define CPU_H
 
+class chip8TraceStream;
+
 #define WIDTH_PIXELS 64
 #define HEIGHT_PIXELS 32
+//SUPER-CHIP hi-res
+#define HIRES_WIDTH_PIXELS 128
+#define HIRES_HEIGHT_PIXELS 64
+
+// Interpreter backends, selectable at runtime so they can be compared.
+// All of them must behave exactly like decodeOpcode.
+enum cpuBackend
+{
+	BACKEND_SWITCH,	//Reference: decodeOpcode's nested switch
+	BACKEND_TABLE,	//Pre-decoded 64K table, threaded dispatch where supported
+	BACKEND_JIT,	//Native x86-64 blocks, table interpreter for the rest
+	BACKEND_CACHED,	//Like TABLE, but decoded once per address instead of per opcode
+					//and common instruction pairs run as one
+	BACKEND_AOT		//Blocks of a linked chip8-aot module, TABLE where there are none
+};
 
-class chip8
+// One machine. Its state is the chip8State base, what is
+// declared here only drives it or caches things derived from it.
+class chip8 : public chip8State
 {
 private:
-	unsigned short
-		stack[16],	//16-level Stack
-		sp,			//Stack pointer
-		opcode,		//Current opcode
-		I,			//Index register
-		pc;			//Program counter
-
-
-	unsigned char
-		delay_timer,   	//These 2 registers when set above zero,
-						//they will count down to it at 60Hz
-		sound_timer;	//When the sound timer reaches zero, the buzzer sounds
-						//TODO: Implement sound
-	char buf[256];
-	std::ostringstream opcode_ss;
-
-	sf::SoundBuffer sound_buffer;
-	sf::Sound beep;
-	unsigned int last2opcodes;
-	unsigned short first2bytes;
-	unsigned short second2bytes;
+	chip8Events* events;
+	traceBuffer trace;
+	traceEntry pending;	//Instruction being traced right now
+	std::unique_ptr<chip8Jit> jit;	//Created the first time BACKEND_JIT runs
+	std::unique_ptr<decodedOp[]> icache;	//Decoded instruction per address (BACKEND_CACHED)
+	const chip8AotModule* aot = nullptr;	//Module the blocks below are from
+	std::unique_ptr<const chip8AotModule::block*[]> aotBlocks;	//Runnable block per start address (BACKEND_AOT)
+	unsigned aotLow = 0, aotHigh = 0;	//Addresses covered by those blocks
+	std::unique_ptr<chip8Profile> profile;	//Created when profiling starts
+	bool profileOn = false;
+	chip8TraceStream* traceStream = nullptr;
+	bool streaming = false;
+	bool tracked = false;	//Keep writtenPages up to date
+	uint64_t writtenPages[(sizeof memory / 256 + 64) / 64] = {};
+	void markWritten(unsigned addr, unsigned len);
+
 	bool decodeOpcode(unsigned short opcode);
+	template <bool cached, bool observe> bool interpret(short cycles, bool force);
+	bool runTable(short cycles, bool force);
+	bool runCached(short cycles, bool force);
+	bool runJit(short cycles, bool force);
+	bool runAot(short cycles, bool force);
+	void bindAot();
+	void dropAot(unsigned addr, unsigned len);
+	void flushDecoded();
+	void invalidate(unsigned addr, unsigned len);
+	void syncMirror(unsigned addr, unsigned len);
+
+	// Every store to RAM goes through here so that decoded or
+	// compiled copies of the code and the mirror stay valid.
+	// addr is wrapped, the store may run on into the mirror.
+	void wrote(unsigned addr, unsigned len)
+	{
+		effects++;
+		if ((addr < mem::mirrorSize) | (addr + len > addrMask() + 1u)) { syncMirror(addr, len); }
+		if (icache || jit || aotBlocks) { invalidate(addr, len); }
+		if (tracked) { markWritten(addr, len); }
+	}
+
+	// Spin loop detection, see idleLoop. A mark is the state at the
+	// last backward 1NNN taken from its address in the current
+	// emulateCycle call, a few are kept for loops with several jumps.
+	struct idleMark
+	{
+		unsigned short at, I, sp, stack[16];
+		unsigned char V[16], delay, sound;
+		unsigned effects;
+		int executed;
+	} idle[4];
+	unsigned effects = 0;	//Stores (RAM and flags), draws and random numbers, only compared for equality
+	int idleLoop(unsigned short from, int executed, int remaining);
+
+	void setSoundTimer(unsigned char value);
+	void drawSprite(unsigned char vx, unsigned char vy, unsigned short height);
+	void drawExtended(unsigned char vx, unsigned char vy, unsigned short n);
+	void clearScreen();
+	void setResolution(bool high);
+	void scrollVertical(int rows);
+	void scrollHorizontal(int columns);
+	void storeRange(unsigned x, unsigned y);
+	void loadRange(unsigned x, unsigned y);
+	bool exitProgram();
+
+	// Skips jump over F000 NNNN as a whole, the only
+	// instruction that is four bytes long
+	void skipNext()
+	{
+		advancePC();
+		if (memory[pc] == 0xF0 && memory[pc + 1] == 0x00) { advancePC(); }
+	}
+
+	// I is 12-bit like PC, except on XO-CHIP where it reaches all of the 64K
+	unsigned short maxI() const { return (unsigned short)addrMask(); }
+	unsigned short wrapI(unsigned addr) const { return (unsigned short)(addr & addrMask()); }
+	void unknownOpcode(unsigned short opcode) const;
+
+	// Called around every executed instruction by all backends while
+	// observed(), they feed the trace, the trace stream and the profile
+	bool observed() const { return tracing | profileOn | streaming; }
+	void recordBegin();
+	void recordEnd();
 
 public:
 	bool isRunning = true;
-	bool drawFlag = false;
-	bool waitForKey = false;
+	bool tracing = false;	//Record executed instructions (needs CHIP8_TRACE)
+	cpuBackend backend = BACKEND_TABLE;
+
+	chip8();
 
 	void initCpu();
 	int initialize();
-	static int  loadGame(const char* name);
+	// Also picks the mode from the file name: .sc8 is
+	// SUPER-CHIP, .xo8 XO-CHIP, anything else CHIP-8
+	int  loadGame(const char* name);
+	// Loads a ROM from memory instead, returns the bytes loaded, which is
+	// at most what fits below the end of RAM in that mode
+	int  loadRom(const unsigned char* rom, size_t size, chip8Mode m);
 	void keyPress(const unsigned char k);
-	static void keyRelease(const unsigned char k);
-	void advancePC();
+	void keyRelease(const unsigned char k);
+	// Sets the whole keypad at once (bit k is key k), only
+	// the keys that change are pressed or released
+	void setKeys(uint16_t keys);
+	void advancePC()
+	{
+		// PC is 12-bit so we need to wrap around
+		pc = (pc + 2) & mem::pcMask;
+	}
 	bool emulateCycle(short cycles = 1, bool force=false);
+
+	// Counts the timers down once, whoever drives the machine
+	// calls this at 60Hz of emulated time (see chip8Scheduler)
+	void tickTimers()
+	{
+		if (delay_timer > 0)
+			--delay_timer;
+
+		if (sound_timer > 0)
+			setSoundTimer(sound_timer - 1);
+	}
 	bool detInfLoop() const;
 	void stopEmulation();
 
+	// Route sound and diagnostics to a frontend, nullptr mutes them
+	void setEvents(chip8Events* e);
+
+	// Snapshots of the whole machine, a plain memcpy of chip8State
+	void saveState(chip8State& s) const;
+	void loadState(const chip8State& s);
+
+	// Which 256 byte pages of RAM were stored to since the last
+	// clearWritten(), while tracking is on. Loading a state counts
+	// as writing all of them.
+	static const unsigned pageCount = (sizeof memory + 255) / 256;
+	void setWriteTracking(bool on);
+	bool written(unsigned page) const { return (writtenPages[page >> 6] >> (page & 63)) & 1; }
+	void clearWritten();
+
+	// The most recently executed instructions, filled while tracing is set
+	const traceBuffer& getTrace() const { return trace; }
+
+	// Counts executions per address, opcode kind and subroutine
+	// (needs CHIP8_TRACE). Turning it on starts a fresh profile,
+	// turning it off keeps it readable until the next start.
+	void setProfiling(bool on);
+	bool profiling() const { return profileOn; }
+	const chip8Profile* getProfile() const { return profile.get(); }
+
+	// Encodes every executed instruction into a trace file as well
+	// (needs CHIP8_TRACE), nullptr stops. Only call it between runs,
+	// the stream belongs to whichever thread runs the machine.
+	void setTraceStream(chip8TraceStream* s);
+
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,191 @@
+#include <cstdio>
+
+#include "chip8-decode.h"
+
+// Mirrors the validity checks of chip8::decodeOpcode,
+// anything it rejects as unknown must decode to OP_UNKNOWN here
+static opKind kindOf(unsigned short opcode)
+{
+	switch (opcode & 0xF000)
+	{
+	case 0x0000:
+		if ((opcode & 0xFFF0) == 0x00C0) return OP_SCD;
+		if ((opcode & 0xFFF0) == 0x00D0) return OP_SCU;
+		switch (opcode)
+		{
+		case 0x00E0: return OP_CLS;
+		case 0x00EE: return OP_RET;
+		case 0x00FB: return OP_SCR;
+		case 0x00FC: return OP_SCL;
+		case 0x00FD: return OP_EXIT;
+		case 0x00FE: return OP_LOW;
+		case 0x00FF: return OP_HIGH;
+		}
+		return OP_UNKNOWN;
+	case 0x1000: return OP_JP;
+	case 0x2000: return OP_CALL;
+	case 0x3000: return OP_SE_NN;
+	case 0x4000: return OP_SNE_NN;
+	case 0x5000:
+		switch (opcode & 0x000F)
+		{
+		case 0x0: return OP_SE_XY;
+		case 0x2: return OP_SAVE_XY;
+		case 0x3: return OP_LOAD_XY;
+		}
+		return OP_UNKNOWN;
+	case 0x6000: return OP_LD_NN;
+	case 0x7000: return OP_ADD_NN;
+	case 0x8000:
+		switch (opcode & 0x000F)
+		{
+		case 0x0: return OP_LD_XY;
+		case 0x1: return OP_OR;
+		case 0x2: return OP_AND;
+		case 0x3: return OP_XOR;
+		case 0x4: return OP_ADD_XY;
+		case 0x5: return OP_SUB;
+		case 0x6: return OP_SHR;
+		case 0x7: return OP_SUBN;
+		case 0xE: return OP_SHL;
+		}
+		return OP_UNKNOWN;
+	case 0x9000: return OP_SNE_XY;	// decodeOpcode ignores the low nibble
+	case 0xA000: return OP_LD_I;
+	case 0xB000: return OP_JP_V0;
+	case 0xC000: return OP_RND;
+	case 0xD000: return OP_DRW;
+	case 0xE000:
+		if ((opcode & 0x00FF) == 0x9E) return OP_SKP;
+		if ((opcode & 0x00FF) == 0xA1) return OP_SKNP;
+		return OP_UNKNOWN;
+	case 0xF000:
+		if (opcode == 0xF000) return OP_LD_I_LONG;
+		if (opcode == 0xF002) return OP_AUDIO;
+		switch (opcode & 0x00FF)
+		{
+		case 0x01: return (opcode & 0x0C00) == 0 ? OP_PLANE : OP_UNKNOWN;
+		case 0x07: return OP_LD_VX_DT;
+		case 0x0A: return OP_LD_K;
+		case 0x15: return OP_LD_DT;
+		case 0x18: return OP_LD_ST;
+		case 0x1E: return OP_ADD_I;
+		case 0x29: return OP_LD_F;
+		case 0x30: return OP_LD_HF;
+		case 0x33: return OP_BCD;
+		case 0x3A: return OP_PITCH;
+		case 0x55: return OP_STORE;
+		case 0x65: return OP_LOAD;
+		case 0x75: return OP_SAVE_FLAGS;
+		case 0x85: return OP_LOAD_FLAGS;
+		}
+		return OP_UNKNOWN;
+	}
+	return OP_UNKNOWN;
+}
+
+decodedOp decode(unsigned short opcode)
+{
+	decodedOp d;
+	d.kind = kindOf(opcode);
+	d.x = (opcode & 0x0F00) >> 8;
+	d.y = (opcode & 0x00F0) >> 4;
+	d.n = opcode & 0x000F;
+	d.nn = opcode & 0x00FF;
+	d.nnn = opcode & 0x0FFF;
+	d.opcode = opcode;
+	return d;
+}
+
+const decodedOp* decodeTable()
+{
+	// Built on first use, 512KB shared by every machine
+	static const decodedOp* table = []
+	{
+		static decodedOp t[0x10000];
+		for (unsigned op = 0; op < 0x10000; op++)
+			t[op] = decode((unsigned short)op);
+		return t;
+	}();
+	return table;
+}
+
+const char* kindName(opKind kind)
+{
+	// Must follow the order of opKind
+	static const char* const names[OP_COUNT] =
+	{
+		"????",
+		"00E0", "00EE", "00CN", "00DN", "00FB", "00FC", "00FD", "00FE", "00FF",
+		"1NNN", "2NNN",
+		"3XNN", "4XNN", "5XY0", "5XY2", "5XY3", "6XNN", "7XNN",
+		"8XY0", "8XY1", "8XY2", "8XY3", "8XY4",
+		"8XY5", "8XY6", "8XY7", "8XYE", "9XY0",
+		"ANNN", "BNNN", "CXNN", "DXYN", "EX9E", "EXA1",
+		"F000", "FN01", "F002",
+		"FX07", "FX0A", "FX15", "FX18", "FX1E",
+		"FX29", "FX30", "FX33", "FX3A", "FX55", "FX65", "FX75", "FX85"
+	};
+	return kind < OP_COUNT ? names[kind] : "????";
+}
+
+int disassemble(unsigned short opcode, char* buf, size_t len)
+{
+	const decodedOp d = decode(opcode);
+	const unsigned x = d.x, y = d.y, n = d.n, nn = d.nn, nnn = d.nnn;
+
+	switch (d.kind)
+	{
+	case OP_CLS:		return snprintf(buf, len, "CLS");
+	case OP_RET:		return snprintf(buf, len, "RET");
+	case OP_SCD:		return snprintf(buf, len, "SCD %X", n);
+	case OP_SCU:		return snprintf(buf, len, "SCU %X", n);
+	case OP_SCR:		return snprintf(buf, len, "SCR");
+	case OP_SCL:		return snprintf(buf, len, "SCL");
+	case OP_EXIT:		return snprintf(buf, len, "EXIT");
+	case OP_LOW:		return snprintf(buf, len, "LOW");
+	case OP_HIGH:		return snprintf(buf, len, "HIGH");
+	case OP_JP:			return snprintf(buf, len, "JP %03X", nnn);
+	case OP_CALL:		return snprintf(buf, len, "CALL %03X", nnn);
+	case OP_SE_NN:		return snprintf(buf, len, "SE V%X, %02X", x, nn);
+	case OP_SNE_NN:		return snprintf(buf, len, "SNE V%X, %02X", x, nn);
+	case OP_SE_XY:		return snprintf(buf, len, "SE V%X, V%X", x, y);
+	case OP_SAVE_XY:	return snprintf(buf, len, "LD [I], V%X-V%X", x, y);
+	case OP_LOAD_XY:	return snprintf(buf, len, "LD V%X-V%X, [I]", x, y);
+	case OP_LD_NN:		return snprintf(buf, len, "LD V%X, %02X", x, nn);
+	case OP_ADD_NN:		return snprintf(buf, len, "ADD V%X, %02X", x, nn);
+	case OP_LD_XY:		return snprintf(buf, len, "LD V%X, V%X", x, y);
+	case OP_OR:			return snprintf(buf, len, "OR V%X, V%X", x, y);
+	case OP_AND:		return snprintf(buf, len, "AND V%X, V%X", x, y);
+	case OP_XOR:		return snprintf(buf, len, "XOR V%X, V%X", x, y);
+	case OP_ADD_XY:		return snprintf(buf, len, "ADD V%X, V%X", x, y);
+	case OP_SUB:		return snprintf(buf, len, "SUB V%X, V%X", x, y);
+	case OP_SHR:		return snprintf(buf, len, "SHR V%X", x);
+	case OP_SUBN:		return snprintf(buf, len, "SUBN V%X, V%X", x, y);
+	case OP_SHL:		return snprintf(buf, len, "SHL V%X", x);
+	case OP_SNE_XY:		return snprintf(buf, len, "SNE V%X, V%X", x, y);
+	case OP_LD_I:		return snprintf(buf, len, "LD I, %03X", nnn);
+	case OP_JP_V0:		return snprintf(buf, len, "JP V0, %03X", nnn);
+	case OP_RND:		return snprintf(buf, len, "RND V%X, %02X", x, nn);
+	case OP_DRW:		return snprintf(buf, len, "DRW V%X, V%X, %X", x, y, n);
+	case OP_SKP:		return snprintf(buf, len, "SKP V%X", x);
+	case OP_SKNP:		return snprintf(buf, len, "SKNP V%X", x);
+	case OP_LD_I_LONG:	return snprintf(buf, len, "LD I, LONG");
+	case OP_PLANE:		return snprintf(buf, len, "PLANE %X", x);
+	case OP_AUDIO:		return snprintf(buf, len, "AUDIO");
+	case OP_LD_VX_DT:	return snprintf(buf, len, "LD V%X, DT", x);
+	case OP_LD_K:		return snprintf(buf, len, "LD V%X, K", x);
+	case OP_LD_DT:		return snprintf(buf, len, "LD DT, V%X", x);
+	case OP_LD_ST:		return snprintf(buf, len, "LD ST, V%X", x);
+	case OP_ADD_I:		return snprintf(buf, len, "ADD I, V%X", x);
+	case OP_LD_F:		return snprintf(buf, len, "LD F, V%X", x);
+	case OP_LD_HF:		return snprintf(buf, len, "LD HF, V%X", x);
+	case OP_BCD:		return snprintf(buf, len, "LD B, V%X", x);
+	case OP_PITCH:		return snprintf(buf, len, "PITCH V%X", x);
+	case OP_STORE:		return snprintf(buf, len, "LD [I], V%X", x);
+	case OP_LOAD:		return snprintf(buf, len, "LD V%X, [I]", x);
+	case OP_SAVE_FLAGS:	return snprintf(buf, len, "LD R, V%X", x);
+	case OP_LOAD_FLAGS:	return snprintf(buf, len, "LD V%X, R", x);
+	default:			return snprintf(buf, len, "DW %04X", opcode);
+	}
+}
@@ -0,0 +1,106 @@
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#ifndef DECODE_H
+#define DECODE_H
+
+#include <cstddef>
+
+// Every instruction the core knows, in the same order as decodeOpcode.
+// CHIP-8, SUPER-CHIP and XO-CHIP opcodes don't overlap, so they share one set.
+enum opKind : unsigned char
+{
+	OP_UNKNOWN,
+	OP_CLS,		//00E0
+	OP_RET,		//00EE
+	OP_SCD,		//00CN	SUPER-CHIP: scroll down N rows
+	OP_SCU,		//00DN	XO-CHIP: scroll up N rows
+	OP_SCR,		//00FB	SUPER-CHIP: scroll right 4 pixels
+	OP_SCL,		//00FC	SUPER-CHIP: scroll left 4 pixels
+	OP_EXIT,	//00FD	SUPER-CHIP
+	OP_LOW,		//00FE	SUPER-CHIP: 64x32
+	OP_HIGH,	//00FF	SUPER-CHIP: 128x64
+	OP_JP,		//1NNN
+	OP_CALL,	//2NNN
+	OP_SE_NN,	//3XNN
+	OP_SNE_NN,	//4XNN
+	OP_SE_XY,	//5XY0
+	OP_SAVE_XY,	//5XY2	XO-CHIP: store VX to VY at I
+	OP_LOAD_XY,	//5XY3	XO-CHIP: load VX to VY from I
+	OP_LD_NN,	//6XNN
+	OP_ADD_NN,	//7XNN
+	OP_LD_XY,	//8XY0
+	OP_OR,		//8XY1
+	OP_AND,		//8XY2
+	OP_XOR,		//8XY3
+	OP_ADD_XY,	//8XY4
+	OP_SUB,		//8XY5
+	OP_SHR,		//8XY6
+	OP_SUBN,	//8XY7
+	OP_SHL,		//8XYE
+	OP_SNE_XY,	//9XY0
+	OP_LD_I,	//ANNN
+	OP_JP_V0,	//BNNN
+	OP_RND,		//CXNN
+	OP_DRW,		//DXYN, DXY0 draws 16x16
+	OP_SKP,		//EX9E
+	OP_SKNP,	//EXA1
+	OP_LD_I_LONG,//F000 NNNN	XO-CHIP: four bytes long
+	OP_PLANE,	//FN01	XO-CHIP: select bitplanes
+	OP_AUDIO,	//F002	XO-CHIP: load the audio pattern
+	OP_LD_VX_DT,//FX07
+	OP_LD_K,	//FX0A
+	OP_LD_DT,	//FX15
+	OP_LD_ST,	//FX18
+	OP_ADD_I,	//FX1E
+	OP_LD_F,	//FX29
+	OP_LD_HF,	//FX30	SUPER-CHIP: big digit
+	OP_BCD,		//FX33
+	OP_PITCH,	//FX3A	XO-CHIP
+	OP_STORE,	//FX55
+	OP_LOAD,	//FX65
+	OP_SAVE_FLAGS,//FX75	SUPER-CHIP
+	OP_LOAD_FLAGS,//FX85	SUPER-CHIP
+	OP_COUNT,
+	OP_UNDECODED = OP_COUNT,	//Empty slot of an address-indexed cache
+
+	// Instructions BACKEND_CACHED runs as one when they follow each other.
+	// Only its cache holds these, on the first instruction of the run.
+	OP_SE_JP,		//3XNN 1NNN		Conditional branch
+	OP_SNE_JP,		//4XNN 1NNN
+	OP_ADD_SE,		//7XNN 3XNN		Loop counter
+	OP_ADD_SNE,		//7XNN 4XNN
+	OP_ADD_SE_JP,	//7XNN 3XNN 1NNN
+	OP_ADD_SNE_JP,	//7XNN 4XNN 1NNN
+	OP_LD_I_DRW,	//ANNN DXYN		Sprite draw
+	OP_LD_I_LOAD,	//ANNN FX65		Table load
+	OP_FUSED_END
+};
+
+// An opcode with its fields already extracted
+struct decodedOp
+{
+	opKind kind;
+	unsigned char
+		x,			//(opcode & 0x0F00) >> 8
+		y,			//(opcode & 0x00F0) >> 4
+		n,			// opcode & 0x000F
+		nn;			// opcode & 0x00FF
+	unsigned short
+		nnn,		// opcode & 0x0FFF
+		opcode;		//The raw instruction
+};
+
+decodedOp decode(unsigned short opcode);
+
+// All 64K opcodes decoded once, index it with the raw opcode
+const decodedOp* decodeTable();
+
+// The opcode pattern of a kind, e.g. "DXYN"
+const char* kindName(opKind kind);
+
+// Writes the assembly for an opcode, e.g. "DRW V3, V4, 5"
+// Returns the number of characters written (like snprintf)
+int disassemble(unsigned short opcode, char* buf, size_t len);
+#endif
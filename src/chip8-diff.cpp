@@ -0,0 +1,258 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+#include "chip8-diff.h"
+
+// Everything after RAM, copied whole at every checkpoint
+static const size_t regsOffset = offsetof(chip8State, V);
+
+static uint64_t mix(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+static uint64_t hashBytes(const void* data, size_t n, uint64_t h)
+{
+	auto p = static_cast<const unsigned char*>(data);
+	for (; n >= 8; n -= 8, p += 8)
+	{
+		uint64_t w;
+		std::memcpy(&w, p, 8);
+		h = ((h << 5 | h >> 59) ^ w) * 0x9E3779B97F4A7C15ULL;
+	}
+	for (; n; n--, p++)
+		h = ((h << 5 | h >> 59) ^ *p) * 0x9E3779B97F4A7C15ULL;
+	return mix(h);
+}
+
+// Like the runner, a machine stops when emulateCycle says so
+static void execute(chip8& m, short cycles)
+{
+	if (!m.emulateCycle(cycles)) { m.isRunning = false; }
+}
+
+static bool stopped(const chip8& m)
+{
+	return !m.isRunning && !m.waitForKey;
+}
+
+// Lists what differs between two machines into what, true if anything does.
+// The opcode and draw flag are left out, compiled blocks don't keep them.
+static bool compare(const chip8& a, const chip8& b, char* what, size_t len)
+{
+	size_t used = 0;
+	what[0] = '\0';
+	auto add = [&](const char* part) {
+		const int n = std::snprintf(what + used, len - used, "%s%s", used ? " " : "", part);
+		if (n > 0) { used = std::min(len - 1, used + size_t(n)); }
+	};
+
+	char name[16];
+	for (unsigned r = 0; r < 16; r++)
+	{
+		if (a.V[r] == b.V[r]) { continue; }
+		std::snprintf(name, sizeof name, "V%X", r);
+		add(name);
+	}
+	if (a.I != b.I) { add("I"); }
+	if (a.pc != b.pc) { add("pc"); }
+	if (a.sp != b.sp || std::memcmp(a.stack, b.stack, sizeof a.stack)) { add("stack"); }
+	if (a.delay_timer != b.delay_timer || a.sound_timer != b.sound_timer) { add("timers"); }
+	if (a.rng != b.rng) { add("rng"); }
+	if (std::memcmp(a.pixels, b.pixels, sizeof a.pixels)) { add("pixels"); }
+	if (a.hires != b.hires || a.planes != b.planes || a.mode != b.mode) { add("display"); }
+	if (std::memcmp(a.flags, b.flags, sizeof a.flags)) { add("flags"); }
+	if (std::memcmp(a.pattern, b.pattern, sizeof a.pattern) || a.pitch != b.pitch) { add("audio"); }
+	if (a.isRunning != b.isRunning || a.waitForKey != b.waitForKey) { add("running"); }
+
+	for (unsigned addr = 0; addr < sizeof a.memory; addr++)
+	{
+		if (a.memory[addr] == b.memory[addr]) { continue; }
+		std::snprintf(name, sizeof name, "memory@%04X", addr);
+		add(name);
+		break;
+	}
+	return used != 0;
+}
+
+chip8Diff::chip8Diff(cpuBackend reference, cpuBackend tested)
+{
+	const cpuBackend backends[2] = { reference, tested };
+	for (unsigned i = 0; i < 2; i++)
+	{
+		m[i].reset(new chip8);
+		m[i]->backend = backends[i];
+		start[i].reset(new chip8State);
+	}
+	found = {};
+}
+
+void chip8Diff::load(const unsigned char* rom, size_t size, chip8Mode mode, uint64_t seed)
+{
+	for (unsigned i = 0; i < 2; i++)
+	{
+		chip8& c = *m[i];
+		c.initialize();
+		c.isRunning = true;
+		c.loadRom(rom, size, mode);
+		c.seed(seed);
+
+		// Every page counts as written, so all of them get hashed once
+		c.setWriteTracking(true);
+		std::fill_n(pageHash[i], chip8::pageCount, 0);
+		memHash[i] = 0;
+		hash(i);
+		checkpoint(i);
+	}
+	frame = 0;
+	found = {};
+	input.restart();
+}
+
+void chip8Diff::setInput(const chip8Movie& movie)
+{
+	input = movie;
+	input.restart();
+	hasInput = true;
+}
+
+uint64_t chip8Diff::hash(unsigned i)
+{
+	const chip8& c = *m[i];
+
+	// Only pages stored to since the last checkpoint changed
+	for (unsigned p = 0; p < chip8::pageCount; p++)
+	{
+		if (!c.written(p)) { continue; }
+		const size_t at = size_t(p) * 256;
+		const uint64_t h = hashBytes(c.memory + at, std::min<size_t>(256, sizeof c.memory - at), p);
+		memHash[i] ^= mix(pageHash[i][p] + p) ^ mix(h + p);
+		pageHash[i][p] = h;
+	}
+
+	uint64_t h = memHash[i];
+	h = hashBytes(c.V, sizeof c.V, h);
+	const uint64_t regs[] = { c.I, c.pc, c.sp, c.delay_timer, c.sound_timer, c.rng,
+		uint64_t(c.hires) | uint64_t(c.planes) << 8 | uint64_t(c.mode) << 16 | uint64_t(c.pitch) << 24
+		| uint64_t(c.isRunning) << 32 | uint64_t(c.waitForKey) << 40 };
+	h = hashBytes(regs, sizeof regs, h);
+	h = hashBytes(c.stack, sizeof c.stack, h);
+	h = hashBytes(c.flags, sizeof c.flags, h);
+	h = hashBytes(c.pattern, sizeof c.pattern, h);
+	return hashBytes(c.pixels, sizeof c.pixels, h);
+}
+
+// Makes the current state the one the next frame is rerun from
+void chip8Diff::checkpoint(unsigned i)
+{
+	chip8& c = *m[i];
+	chip8State& s = *start[i];
+
+	for (unsigned p = 0; p < chip8::pageCount; p++)
+	{
+		if (!c.written(p)) { continue; }
+		const size_t at = size_t(p) * 256;
+		std::memcpy(s.memory + at, c.memory + at, std::min<size_t>(256, sizeof c.memory - at));
+	}
+	std::memcpy(reinterpret_cast<unsigned char*>(&s) + regsOffset,
+		reinterpret_cast<const unsigned char*>(static_cast<const chip8State*>(&c)) + regsOffset,
+		sizeof(chip8State) - regsOffset);
+	c.clearWritten();
+}
+
+// Back to the start of the frame, with its input applied
+void chip8Diff::restart(unsigned i)
+{
+	chip8& c = *m[i];
+	c.loadState(*start[i]);
+	c.isRunning = runningAtStart[i];
+	startFrame(i);
+}
+
+void chip8Diff::startFrame(unsigned i)
+{
+	chip8& c = *m[i];
+	if (hasInput) { c.setKeys(frameKeys); }
+	else if (c.waitForKey)
+	{
+		c.keyPress(frame & 0xF);
+		c.keyRelease(frame & 0xF);
+	}
+}
+
+bool chip8Diff::run(uint64_t frames, short cycles)
+{
+	for (uint64_t f = 0; f < frames; f++)
+	{
+		if (stopped(*m[0]) && stopped(*m[1])) { break; }
+
+		frameKeys = hasInput ? input.next() : 0;
+		for (unsigned i = 0; i < 2; i++)
+		{
+			runningAtStart[i] = m[i]->isRunning;
+			startFrame(i);
+			execute(*m[i], cycles);
+			m[i]->tickTimers();
+		}
+
+		if (hash(0) != hash(1))
+		{
+			locate(cycles);
+			return false;
+		}
+		checkpoint(0);
+		checkpoint(1);
+		frame++;
+	}
+	return true;
+}
+
+void chip8Diff::locate(short cycles)
+{
+	found = {};
+	found.frame = frame;
+
+	for (short k = 1; k <= cycles; k++)
+	{
+		for (unsigned i = 0; i < 2; i++)
+		{
+			restart(i);
+			execute(*m[i], k);
+		}
+		if (!compare(*m[0], *m[1], found.what, sizeof found.what)) { continue; }
+
+		// Where the reference was right before it
+		restart(0);
+		if (k > 1) { execute(*m[0], k - 1); }
+		const chip8& r = *m[0];
+		found.instruction = unsigned(k - 1);
+		found.pc = r.pc;
+		found.opcode = r.memory[r.pc] << 8 | r.memory[r.pc + 1];
+		found.exact = true;
+
+		// Leave both right after the diverging instruction
+		restart(0);
+		execute(*m[0], k);
+		return;
+	}
+
+	// Only the whole frame diverges, e.g. through a timer tick or
+	// something that depends on how long the batch is. Redo it the
+	// way run() did and report how it ended.
+	for (unsigned i = 0; i < 2; i++)
+	{
+		restart(i);
+		execute(*m[i], cycles);
+		m[i]->tickTimers();
+	}
+	compare(*m[0], *m[1], found.what, sizeof found.what);
+	found.pc = start[0]->pc;
+	found.opcode = start[0]->memory[found.pc] << 8 | start[0]->memory[found.pc + 1];
+}
@@ -0,0 +1,79 @@
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#ifndef DIFF_H
+#define DIFF_H
+
+#include <cstdint>
+#include <memory>
+
+#include "chip8-cpu.h"
+#include "chip8-movie.h"
+
+// Runs one ROM on two backends side by side to find where the
+// tested one stops behaving like the reference.
+//
+// Both machines run the same frames of instructions with the same
+// input. After every frame their hashes are compared: registers,
+// stack, timers, the CXNN generator, the framebuffer and RAM. RAM is
+// hashed per 256 byte page, only the pages stored to during the frame
+// are hashed again.
+//
+// When the hashes differ both machines go back to the start of the
+// frame and run its first 1, 2, 3... instructions in one call each,
+// until the whole states differ. That finds the instruction even if
+// the tested backend only gets it wrong in compiled blocks, which a
+// single-stepped machine never runs.
+class chip8Diff
+{
+public:
+	struct divergence
+	{
+		uint64_t frame;			//Frame in which the hashes differed
+		unsigned instruction;	//Instructions of the frame that ran fine before it
+		unsigned short pc;		//Address and opcode of the diverging instruction
+		unsigned short opcode;
+		bool exact;				//False if rerunning the frame didn't reproduce it
+		char what[96];			//Which parts of the state differ, e.g. "V3 I pixels"
+	};
+
+	chip8Diff(cpuBackend reference, cpuBackend tested);
+
+	// Loads a ROM into both machines, as loadGame would
+	void load(const unsigned char* rom, size_t size, chip8Mode mode, uint64_t seed = 0);
+
+	// Plays the keypad from a movie, one state per frame. Without
+	// one FX0A is answered right away, with key frame % 16.
+	void setInput(const chip8Movie& movie);
+
+	// Runs up to `frames` frames of `cycles` instructions, with a timer
+	// tick after each. Stops early when both machines have stopped.
+	// False on divergence, see result().
+	bool run(uint64_t frames, short cycles);
+
+	const divergence& result() const { return found; }
+	uint64_t framesRun() const { return frame; }
+	const chip8& machine(unsigned i) const { return *m[i]; }
+
+private:
+	std::unique_ptr<chip8> m[2];
+	std::unique_ptr<chip8State> start[2];	//Both machines at the start of the frame
+	uint64_t pageHash[2][chip8::pageCount];
+	uint64_t memHash[2];
+
+	bool runningAtStart[2];	//chip8::isRunning isn't part of the state
+
+	chip8Movie input;
+	bool hasInput = false;
+	uint16_t frameKeys = 0;
+	uint64_t frame = 0;
+	divergence found;
+
+	uint64_t hash(unsigned i);
+	void checkpoint(unsigned i);
+	void restart(unsigned i);
+	void startFrame(unsigned i);
+	void locate(short cycles);
+};
+#endif
@@ -0,0 +1,442 @@
+#include <algorithm>
+
+#include "chip8-cpu.h"
+#include "chip8-memory.h"
+#include "chip8-decode.h"
+
+// GCC and Clang can jump from one handler straight to the next
+// through a table of label addresses (computed goto), so every handler
+// ends in its own indirect branch the CPU can predict separately.
+// Other compilers get the same handlers as cases of one switch.
+#if defined(__GNUC__) && !defined(CHIP8_NO_THREADING)
+#define CHIP8_THREADED 1
+#endif
+
+#ifdef CHIP8_THREADED
+#define HANDLER(kind) L_##kind:
+#define DISPATCH() goto *labels[d->kind]
+#else
+#define HANDLER(kind) case kind:
+#define DISPATCH() goto dispatch
+#endif
+
+// The cached variant decodes each address the first time it runs
+// and keeps the result until a store overwrites that code
+#define FETCH() \
+	do { \
+		if (cached && pc <= mem::pcMask) \
+		{ \
+			d = &icache[pc]; \
+			if (d->kind == OP_UNDECODED) \
+				fill(icache.get(), memory, table, pc); \
+		} \
+		else \
+		{ \
+			d = &table[memory[pc] << 8 | memory[pc + 1]]; \
+		} \
+		opcode = d->opcode; \
+		if (observe) { recordBegin(); } \
+	} while (0)
+
+// Finish the current instruction and dispatch the next one,
+// the same bookkeeping emulateCycle does between decodeOpcode calls.
+// isRunning is only checked on entry, FX0A is the one handler that
+// clears it and returns by itself.
+#define NEXT() \
+	do { \
+		if (observe) { recordEnd(); } \
+		if (++i >= cycles) { return true; } \
+		FETCH(); \
+		DISPATCH(); \
+	} while (0)
+
+// Branches the way the 1NNN handler does, including the loop checks
+#define JUMP(target) \
+	do { \
+		const auto from = pc; \
+		pc = (target); \
+		if (detInfLoop()) { return false; } \
+		if (pc <= from) { i += idleLoop(from, i + 1, cycles - i - 1); } \
+		NEXT(); \
+	} while (0)
+
+// A fused handler only runs its first instruction unless the call has
+// cycles left for all of them and nobody watches single instructions
+#define FUSED(count) (i + (count) <= cycles && !observe)
+
+// Moves a fused handler on to its next instruction
+#define STEP() \
+	do { \
+		i++; \
+		d += 2; \
+		opcode = d->opcode; \
+	} while (0)
+
+// Decodes the instruction at addr into the cache. If the ones after it
+// make one of the fused kinds the entry gets that kind instead, and the
+// entries after it are filled as well since the handler reads them.
+// The whole run must be reachable from addr without PC wrapping.
+static void fill(decodedOp* icache, const unsigned char* memory, const decodedOp* table, unsigned addr)
+{
+	auto next = [&](unsigned k)
+	{
+		const unsigned a = addr + 2 * k;
+		return a <= mem::pcMask ? table[memory[a] << 8 | memory[a + 1]].kind : OP_UNKNOWN;
+	};
+
+	decodedOp& d = icache[addr];
+	d = table[memory[addr] << 8 | memory[addr + 1]];
+
+	opKind fused = d.kind;
+	unsigned length = 2;
+	switch (d.kind)
+	{
+	case OP_SE_NN:
+		if (next(1) == OP_JP) { fused = OP_SE_JP; }
+		break;
+	case OP_SNE_NN:
+		if (next(1) == OP_JP) { fused = OP_SNE_JP; }
+		break;
+	case OP_ADD_NN:
+		if (next(1) != OP_SE_NN && next(1) != OP_SNE_NN) { break; }
+		if (next(2) == OP_JP)
+		{
+			fused = next(1) == OP_SE_NN ? OP_ADD_SE_JP : OP_ADD_SNE_JP;
+			length = 3;
+		}
+		else { fused = next(1) == OP_SE_NN ? OP_ADD_SE : OP_ADD_SNE; }
+		break;
+	case OP_LD_I:
+		if (next(1) == OP_DRW) { fused = OP_LD_I_DRW; }
+		else if (next(1) == OP_LOAD) { fused = OP_LD_I_LOAD; }
+		break;
+	default:
+		break;
+	}
+	if (fused == d.kind) { return; }
+
+	for (unsigned k = 1; k < length; k++)
+	{
+		if (icache[addr + 2 * k].kind == OP_UNDECODED)
+			fill(icache, memory, table, addr + 2 * k);
+	}
+	d.kind = fused;
+}
+
+// Tracing and profiling can't start or stop during a run, so the
+// instructions only check for them when an observed run was picked
+bool chip8::runTable(short cycles, bool force)
+{
+	if (CHIP8_TRACE && observed()) { return interpret<false, true>(cycles, force); }
+	return interpret<false, false>(cycles, force);
+}
+
+bool chip8::runCached(short cycles, bool force)
+{
+	if (!icache)
+	{
+		icache.reset(new decodedOp[0x1000]);
+		flushDecoded();
+	}
+	if (CHIP8_TRACE && observed()) { return interpret<true, true>(cycles, force); }
+	return interpret<true, false>(cycles, force);
+}
+
+// Same contract as emulateCycle, returns false when the emulation must stop
+template <bool cached, bool observe>
+bool chip8::interpret(short cycles, bool force)
+{
+#ifdef CHIP8_THREADED
+	// Must follow the order of opKind
+	static void* const labels[OP_FUSED_END] =
+	{
+		&&L_OP_UNKNOWN,
+		&&L_OP_CLS, &&L_OP_RET, &&L_OP_SCD, &&L_OP_SCU, &&L_OP_SCR, &&L_OP_SCL,
+		&&L_OP_EXIT, &&L_OP_LOW, &&L_OP_HIGH, &&L_OP_JP, &&L_OP_CALL,
+		&&L_OP_SE_NN, &&L_OP_SNE_NN, &&L_OP_SE_XY, &&L_OP_SAVE_XY, &&L_OP_LOAD_XY,
+		&&L_OP_LD_NN, &&L_OP_ADD_NN,
+		&&L_OP_LD_XY, &&L_OP_OR, &&L_OP_AND, &&L_OP_XOR, &&L_OP_ADD_XY,
+		&&L_OP_SUB, &&L_OP_SHR, &&L_OP_SUBN, &&L_OP_SHL, &&L_OP_SNE_XY,
+		&&L_OP_LD_I, &&L_OP_JP_V0, &&L_OP_RND, &&L_OP_DRW, &&L_OP_SKP, &&L_OP_SKNP,
+		&&L_OP_LD_I_LONG, &&L_OP_PLANE, &&L_OP_AUDIO,
+		&&L_OP_LD_VX_DT, &&L_OP_LD_K, &&L_OP_LD_DT, &&L_OP_LD_ST, &&L_OP_ADD_I,
+		&&L_OP_LD_F, &&L_OP_LD_HF, &&L_OP_BCD, &&L_OP_PITCH, &&L_OP_STORE, &&L_OP_LOAD,
+		&&L_OP_SAVE_FLAGS, &&L_OP_LOAD_FLAGS,
+		&&L_OP_UNKNOWN,	//OP_UNDECODED, filled before dispatch
+		&&L_OP_SE_JP, &&L_OP_SNE_JP, &&L_OP_ADD_SE, &&L_OP_ADD_SNE,
+		&&L_OP_ADD_SE_JP, &&L_OP_ADD_SNE_JP, &&L_OP_LD_I_DRW, &&L_OP_LD_I_LOAD
+	};
+#endif
+
+	const decodedOp* const table = decodeTable();
+	const decodedOp* d;
+	int i = 0;
+
+	if (cycles <= 0 || (!isRunning & !force)) { return true; }
+
+	FETCH();
+
+#ifndef CHIP8_THREADED
+dispatch:
+	switch (d->kind)
+	{
+#else
+	DISPATCH();
+#endif
+
+	HANDLER(OP_CLS)
+		clearScreen();
+		advancePC(); NEXT();
+	HANDLER(OP_RET)
+		sp = (sp - 1) & 0xF;
+		pc = stack[sp] & mem::pcMask;
+		advancePC(); NEXT();
+	HANDLER(OP_SCD)
+		scrollVertical(d->n);
+		advancePC(); NEXT();
+	HANDLER(OP_SCU)
+		scrollVertical(-d->n);
+		advancePC(); NEXT();
+	HANDLER(OP_SCR)
+		scrollHorizontal(4);
+		advancePC(); NEXT();
+	HANDLER(OP_SCL)
+		scrollHorizontal(-4);
+		advancePC(); NEXT();
+	HANDLER(OP_EXIT)
+		return exitProgram();
+	HANDLER(OP_LOW)
+		setResolution(false);
+		advancePC(); NEXT();
+	HANDLER(OP_HIGH)
+		setResolution(true);
+		advancePC(); NEXT();
+	HANDLER(OP_JP)
+		JUMP(d->nnn);
+	HANDLER(OP_CALL)
+		stack[sp] = pc;
+		sp = (sp + 1) % 0xF;
+		pc = d->nnn;
+		NEXT();
+	HANDLER(OP_SE_NN)
+		if (V[d->x] == d->nn) { skipNext(); }
+		advancePC(); NEXT();
+	HANDLER(OP_SNE_NN)
+		if (V[d->x] != d->nn) { skipNext(); }
+		advancePC(); NEXT();
+	HANDLER(OP_SE_XY)
+		if (V[d->x] == V[d->y]) { skipNext(); }
+		advancePC(); NEXT();
+	HANDLER(OP_SAVE_XY)
+		storeRange(d->x, d->y);
+		advancePC(); NEXT();
+	HANDLER(OP_LOAD_XY)
+		loadRange(d->x, d->y);
+		advancePC(); NEXT();
+	HANDLER(OP_LD_NN)
+		V[d->x] = d->nn;
+		advancePC(); NEXT();
+	HANDLER(OP_ADD_NN)
+		V[d->x] += d->nn;
+		advancePC(); NEXT();
+	HANDLER(OP_LD_XY)
+		V[d->x] = V[d->y];
+		advancePC(); NEXT();
+	HANDLER(OP_OR)
+		V[d->x] |= V[d->y];
+		advancePC(); NEXT();
+	HANDLER(OP_AND)
+		V[d->x] &= V[d->y];
+		advancePC(); NEXT();
+	HANDLER(OP_XOR)
+		V[d->x] ^= V[d->y];
+		advancePC(); NEXT();
+	// VF is written before VX in the arithmetic handlers,
+	// exactly like decodeOpcode, which matters when X or Y is F
+	HANDLER(OP_ADD_XY)
+		V[0xF] = V[d->y] > (0xFF - V[d->x]);
+		V[d->x] += V[d->y];
+		advancePC(); NEXT();
+	HANDLER(OP_SUB)
+		V[0xF] = !(V[d->y] > V[d->x]);
+		V[d->x] -= V[d->y];
+		advancePC(); NEXT();
+	HANDLER(OP_SHR)
+		V[0xF] = V[d->x] & 1;
+		V[d->x] >>= 1;
+		advancePC(); NEXT();
+	HANDLER(OP_SUBN)
+		V[0xF] = !(V[d->y] < V[d->x]);
+		V[d->x] = V[d->y] - V[d->x];
+		advancePC(); NEXT();
+	HANDLER(OP_SHL)
+		V[0xF] = (V[d->x] >> 7) & 1;
+		V[d->x] <<= 1;
+		advancePC(); NEXT();
+	HANDLER(OP_SNE_XY)
+		if (V[d->x] != V[d->y]) { skipNext(); }
+		advancePC(); NEXT();
+	HANDLER(OP_LD_I)
+		I = d->nnn;
+		advancePC(); NEXT();
+	HANDLER(OP_JP_V0)
+		pc = (d->nnn + V[0x0]) & mem::pcMask;
+		NEXT();
+	HANDLER(OP_RND)
+		V[d->x] = random(rng) & d->nn;
+		effects++;
+		advancePC(); NEXT();
+	HANDLER(OP_DRW)
+		drawSprite(V[d->x], V[d->y], d->n);
+		advancePC(); NEXT();
+	HANDLER(OP_SKP)
+		if (keyDown(V[d->x])) { skipNext(); }
+		advancePC(); NEXT();
+	HANDLER(OP_SKNP)
+		if (!keyDown(V[d->x])) { skipNext(); }
+		advancePC(); NEXT();
+	HANDLER(OP_LD_I_LONG)
+		I = wrapI(memory[pc + 2] << 8 | memory[pc + 3]);
+		advancePC();
+		advancePC(); NEXT();
+	HANDLER(OP_PLANE)
+		planes = d->x;
+		advancePC(); NEXT();
+	HANDLER(OP_AUDIO)
+		std::copy_n(memory + I, 16, pattern);
+		advancePC(); NEXT();
+	HANDLER(OP_LD_VX_DT)
+		V[d->x] = delay_timer;
+		advancePC(); NEXT();
+	HANDLER(OP_LD_K)
+		waitForKey = true;
+		isRunning = false;
+		if (!force)
+		{
+			if (observe) { recordEnd(); }
+			return true;
+		}
+		NEXT();
+	HANDLER(OP_LD_DT)
+		delay_timer = V[d->x];
+		advancePC(); NEXT();
+	HANDLER(OP_LD_ST)
+		setSoundTimer(V[d->x]);
+		advancePC(); NEXT();
+	HANDLER(OP_ADD_I)
+		V[0xF] = V[d->x] > (maxI() - I);
+		I = wrapI(I + V[d->x]);
+		advancePC(); NEXT();
+	HANDLER(OP_LD_F)
+		I = V[d->x] * 5;
+		advancePC(); NEXT();
+	HANDLER(OP_LD_HF)
+		I = mem::bigFontAddr + (V[d->x] & 0xF) * 10;
+		advancePC(); NEXT();
+	HANDLER(OP_BCD)
+	{
+		auto VX = V[d->x];
+		memory[I] = VX / 100;
+		memory[I + 1] = VX / 10 % 10;
+		memory[I + 2] = VX % 100 % 10;
+		wrote(I, 3);
+		advancePC(); NEXT();
+	}
+	HANDLER(OP_PITCH)
+		pitch = V[d->x];
+		advancePC(); NEXT();
+	HANDLER(OP_STORE)
+		for (auto r = 0; r <= d->x; r++)
+		{
+			memory[I + r] = V[r];
+		}
+		wrote(I, d->x + 1);
+		advancePC(); NEXT();
+	HANDLER(OP_LOAD)
+		for (auto r = 0; r <= d->x; r++)
+		{
+			V[r] = memory[I + r];
+		}
+		advancePC(); NEXT();
+	HANDLER(OP_SAVE_FLAGS)
+		effects++;
+		std::copy_n(V, d->x + 1, flags);
+		advancePC(); NEXT();
+	HANDLER(OP_LOAD_FLAGS)
+		std::copy_n(flags, d->x + 1, V);
+		advancePC(); NEXT();
+
+	// Fused runs, see fill(). They do exactly what their instructions
+	// do one after the other, a taken skip ends them early.
+	HANDLER(OP_SE_JP)
+		if (V[d->x] == d->nn) { skipNext(); advancePC(); NEXT(); }
+		advancePC();
+		if (!FUSED(2)) { NEXT(); }
+		STEP();
+		JUMP(d->nnn);
+	HANDLER(OP_SNE_JP)
+		if (V[d->x] != d->nn) { skipNext(); advancePC(); NEXT(); }
+		advancePC();
+		if (!FUSED(2)) { NEXT(); }
+		STEP();
+		JUMP(d->nnn);
+	HANDLER(OP_ADD_SE)
+		V[d->x] += d->nn;
+		advancePC();
+		if (!FUSED(2)) { NEXT(); }
+		STEP();
+		if (V[d->x] == d->nn) { skipNext(); }
+		advancePC(); NEXT();
+	HANDLER(OP_ADD_SNE)
+		V[d->x] += d->nn;
+		advancePC();
+		if (!FUSED(2)) { NEXT(); }
+		STEP();
+		if (V[d->x] != d->nn) { skipNext(); }
+		advancePC(); NEXT();
+	HANDLER(OP_ADD_SE_JP)
+		V[d->x] += d->nn;
+		advancePC();
+		if (!FUSED(3)) { NEXT(); }
+		STEP();
+		if (V[d->x] == d->nn) { skipNext(); advancePC(); NEXT(); }
+		advancePC();
+		STEP();
+		JUMP(d->nnn);
+	HANDLER(OP_ADD_SNE_JP)
+		V[d->x] += d->nn;
+		advancePC();
+		if (!FUSED(3)) { NEXT(); }
+		STEP();
+		if (V[d->x] != d->nn) { skipNext(); advancePC(); NEXT(); }
+		advancePC();
+		STEP();
+		JUMP(d->nnn);
+	HANDLER(OP_LD_I_DRW)
+		I = d->nnn;
+		advancePC();
+		if (!FUSED(2)) { NEXT(); }
+		STEP();
+		drawSprite(V[d->x], V[d->y], d->n);
+		advancePC(); NEXT();
+	HANDLER(OP_LD_I_LOAD)
+		I = d->nnn;
+		advancePC();
+		if (!FUSED(2)) { NEXT(); }
+		STEP();
+		for (auto r = 0; r <= d->x; r++)
+		{
+			V[r] = memory[I + r];
+		}
+		advancePC(); NEXT();
+
+	HANDLER(OP_UNKNOWN)
+#ifndef CHIP8_THREADED
+	default:
+#endif
+		unknownOpcode(opcode);
+		return false; // We can't handle this opcode, so stop the emulation
+#ifndef CHIP8_THREADED
+	}
+#endif
+}
@@ -0,0 +1,165 @@
+#include <algorithm>
+#include <cstring>
+
+#include "chip8-env.h"
+
+static size_t align64(size_t n)
+{
+	return (n + 63) & ~size_t(63);
+}
+
+chip8Env::chip8Env(size_t machines, const unsigned char* rom, size_t romSize, chip8Mode mode, const chip8EnvConfig& c)
+	: pool(c.threads), cfg(c), held(machines, 0), observed(machines, 0)
+{
+	cfg.frameSkip = std::max(1u, cfg.frameSkip);
+
+	for (size_t i = 0; i < machines; i++)
+		pool.add();
+
+	if (!machines) { return; }
+
+	// Every machine starts from the same state
+	chip8& first = pool[0];
+	first.loadRom(rom, romSize, mode);
+	first.saveState(start);
+	reset();
+}
+
+size_t chip8Env::frameBytes() const
+{
+	if (cfg.format == OBS_PACKED) { return sizeof(chip8State::pixels); }
+	return cfg.hiresBytes ? 128 * 64 : 64 * 32;
+}
+
+size_t chip8Env::regionBytes() const
+{
+	const size_t n = size();
+	return align64(n * frameBytes()) + align64(n * sizeof(registers))
+		+ align64(n * sizeof(float)) + align64(n);
+}
+
+chip8Env::outputs chip8Env::bind(void* region) const
+{
+	const size_t n = size();
+	auto p = static_cast<unsigned char*>(region);
+
+	outputs out;
+	out.frames = p;
+	p += align64(n * frameBytes());
+	out.regs = reinterpret_cast<registers*>(p);
+	p += align64(n * sizeof(registers));
+	out.rewards = reinterpret_cast<float*>(p);
+	p += align64(n * sizeof(float));
+	out.done = p;
+	return out;
+}
+
+void chip8Env::reset()
+{
+	for (size_t i = 0; i < size(); i++)
+		reset(i);
+}
+
+void chip8Env::reset(size_t index)
+{
+	chip8& m = pool[index];
+	m.loadState(start);
+	m.isRunning = true;
+	held[index] = 0;
+}
+
+void chip8Env::step(const uint16_t* actions, const outputs& out)
+{
+	for (size_t i = 0; i < size(); i++)
+	{
+		chip8& m = pool[i];
+		if (cfg.autoReset && !m.isRunning && !m.waitForKey) { reset(i); }
+
+		// Only keys that changed are pressed or released, so
+		// a key held across steps doesn't answer FX0A again
+		const uint16_t changed = held[i] ^ actions[i];
+		for (unsigned k = 0; k < 16; k++)
+		{
+			if (!(changed >> k & 1)) { continue; }
+			if (actions[i] >> k & 1) { m.keyPress((unsigned char)k); }
+			else { m.keyRelease((unsigned char)k); }
+		}
+		held[i] = actions[i];
+
+		observed[i] = 0;
+		if (out.rewards) { out.rewards[i] = 0; }
+	}
+
+	// Workers write each machine's slice of the outputs themselves
+	const unsigned last = cfg.frameSkip - 1;
+	pool.run(cfg.frameSkip, cfg.cyclesPerFrame, [&](size_t i, chip8& m, unsigned frame)
+	{
+		if (reward && out.rewards) { out.rewards[i] += reward(i, m); }
+		if (frame == last)
+		{
+			write(i, out);
+			observed[i] = 1;
+		}
+		return true;
+	});
+
+	// Machines that stopped partway through the step
+	for (size_t i = 0; i < size(); i++)
+	{
+		if (!observed[i]) { write(i, out); }
+	}
+}
+
+void chip8Env::observe(const outputs& out)
+{
+	for (size_t i = 0; i < size(); i++)
+		write(i, out);
+}
+
+void chip8Env::write(size_t index, const outputs& out)
+{
+	const chip8& m = pool[index];
+
+	if (out.frames) { writeFrame(m, out.frames + index * frameBytes()); }
+
+	if (out.regs)
+	{
+		registers& r = out.regs[index];
+		std::memcpy(r.V, m.V, sizeof r.V);
+		r.I = m.I;
+		r.pc = m.pc;
+		r.sp = m.sp;
+		r.delay = m.delay_timer;
+		r.sound = m.sound_timer;
+		r.hires = m.hires;
+		r.waiting = m.waitForKey;
+	}
+
+	if (out.done) { out.done[index] = !m.isRunning && !m.waitForKey; }
+}
+
+// OBS_BYTES scales the screen to the chosen size, a lo-res screen
+// doubles its pixels in 128x64 and hi-res keeps every other one in 64x32
+void chip8Env::writeFrame(const chip8State& s, unsigned char* frame) const
+{
+	if (cfg.format == OBS_PACKED)
+	{
+		std::memcpy(frame, s.pixels, sizeof s.pixels);
+		return;
+	}
+
+	const unsigned w = cfg.hiresBytes ? 128 : 64, h = w / 2;
+	const unsigned words = s.hires ? 2 : 1;
+	for (unsigned y = 0; y < h; y++)
+	{
+		const unsigned sy = y * s.height() / h;
+		const uint64_t* const p0 = &s.pixels[0][sy * words];
+		const uint64_t* const p1 = &s.pixels[1][sy * words];
+		for (unsigned x = 0; x < w; x++)
+		{
+			const unsigned sx = x * s.width() / w;
+			const unsigned shift = 63 - (sx & 63);
+			*frame++ = (unsigned char)((p0[sx >> 6] >> shift & 1) | (p1[sx >> 6] >> shift & 1) << 1);
+		}
+	}
+}
@@ -0,0 +1,105 @@
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#ifndef ENV_H
+#define ENV_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "chip8-pool.h"
+
+// How chip8Env writes screens
+enum chip8ObsFormat : unsigned char
+{
+	OBS_PACKED,	//chip8State::pixels as is, both planes, one bit per pixel
+	OBS_BYTES	//One byte per pixel, plane 1 in bit 0 and plane 2 in bit 1
+};
+
+// Fixed when a chip8Env is created
+struct chip8EnvConfig
+{
+	short cyclesPerFrame = 12;		//Instructions per 1/60s, 700 per second
+	unsigned frameSkip = 4;			//Frames per step, the action is held for all of them
+	chip8ObsFormat format = OBS_BYTES;
+	bool hiresBytes = false;		//OBS_BYTES is 128x64 instead of 64x32
+	bool autoReset = true;			//A machine that is done starts over on the next step
+	unsigned threads = 0;			//0: one per core
+};
+
+// Many copies of one ROM stepped as an environment for agents.
+//
+// A step presses each machine's keys, runs every machine for a number
+// of frames with those keys held (action repeat) and only observes the
+// last one (frame skip). Observations, registers, rewards and done flags
+// are written by the pool's workers straight into arrays the caller
+// owns, one slice per machine, so nothing is staged or copied again.
+// The arrays can be anywhere, e.g. numpy buffers or one shared memory
+// region laid out by bind().
+class chip8Env
+{
+public:
+	// What an agent sees of a machine besides the screen
+	struct registers
+	{
+		unsigned char V[16];
+		unsigned short I, pc, sp;
+		unsigned char delay, sound;
+		unsigned char hires, waiting;	//waiting: stopped on FX0A
+	};
+
+	// Where step() writes, each array has one entry per machine.
+	// frames holds frameBytes() per machine. Any of them may be nullptr.
+	struct outputs
+	{
+		unsigned char* frames;
+		registers* regs;
+		float* rewards;
+		unsigned char* done;
+	};
+
+	// Called after every frame, the step's reward is the sum
+	typedef std::function<float(size_t index, const chip8& machine)> rewardFn;
+
+	chip8Env(size_t machines, const unsigned char* rom, size_t romSize,
+		chip8Mode mode = MODE_CHIP8, const chip8EnvConfig& c = chip8EnvConfig());
+
+	size_t size() const { return pool.size(); }
+	size_t frameBytes() const;
+
+	// Lays all outputs out in one region of regionBytes(), e.g.
+	// shared memory another process maps too. Every array is 64 byte aligned
+	// relative to the start of the region.
+	size_t regionBytes() const;
+	outputs bind(void* region) const;
+
+	void setReward(const rewardFn& f) { reward = f; }
+
+	// Back to the state right after the ROM was loaded
+	void reset();
+	void reset(size_t index);
+
+	// actions[i] is the key mask of machine i, bit k holds key k down
+	void step(const uint16_t* actions, const outputs& out);
+
+	// Writes the observations without stepping, e.g. after reset()
+	void observe(const outputs& out);
+
+	// Direct access, e.g. to poke RAM before a run
+	chip8& operator[](size_t index) { return pool[index]; }
+
+private:
+	chip8Pool pool;
+	chip8EnvConfig cfg;
+	chip8State start;
+	rewardFn reward;
+	std::vector<uint16_t> held;			//Keys currently down, per machine
+	std::vector<unsigned char> observed;	//Written during the current step
+
+	void write(size_t index, const outputs& out);
+	void writeFrame(const chip8State& s, unsigned char* frame) const;
+};
+#endif
@@ -0,0 +1,24 @@
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#ifndef EVENTS_H
+#define EVENTS_H
+
+// Interface between the emulation core and whatever frontend drives it.
+// The core never touches windows, fonts or audio devices itself,
+// it only reports what happened through these callbacks.
+// Every callback has an empty default so a headless runner
+// only needs to override what it cares about.
+class chip8Events
+{
+public:
+	virtual ~chip8Events() {}
+
+	// The buzzer should start (on == true) or stop (on == false)
+	virtual void sound(bool /*on*/) {}
+
+	// A diagnostic line (executed opcode, errors, state changes)
+	virtual void message(const char* /*text*/) {}
+};
+#endif
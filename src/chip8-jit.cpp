@@ -0,0 +1,437 @@
+#include "chip8-cpu.h"
+#include "chip8-memory.h"
+#include "chip8-decode.h"
+#include "chip8-jit.h"
+
+#if CHIP8_JIT
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+
+//Size of the executable arena, it is simply flushed when full
+#define CODE_SIZE (1 << 20)
+//Upper bound for the code of one instruction (FX65 with X=F is the
+//longest at about 150 bytes) plus the end of the block. A block stops
+//early when less than that is left in the arena.
+#define MAX_OP_BYTES 256
+
+// Only registers that are volatile in both the System V and the
+// Windows x64 calling conventions are used, so blocks never save anything
+enum { RAX = 0, RCX = 1, RDX = 2, R8 = 8, R9 = 9 };
+
+// Condition codes for setcc/cmovcc
+enum { CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_A = 0x7 };
+
+// Appends x86-64 instructions to the arena
+struct emitter
+{
+	unsigned char* p;
+
+	void b(unsigned v) { *p++ = (unsigned char)v; }
+	void w(unsigned v) { b(v); b(v >> 8); }
+	void d(unsigned v) { w(v); w(v >> 16); }
+	void q(unsigned long long v) { d(unsigned(v)); d(unsigned(v >> 32)); }
+
+	// REX prefix, only emitted when it is needed
+	void rex(bool w64, int reg, int rm)
+	{
+		unsigned r = 0x40 | (w64 ? 8 : 0) | (reg & 8 ? 4 : 0) | (rm & 8 ? 1 : 0);
+		if (r != 0x40) { b(r); }
+	}
+
+	// ModRM for [base + disp], base must not be rsp/rbp/r12/r13
+	void mem(int reg, int base, long disp)
+	{
+		if (disp >= -128 && disp <= 127)
+		{
+			b(0x40 | (reg & 7) << 3 | (base & 7));
+			b(unsigned(disp));
+		}
+		else
+		{
+			b(0x80 | (reg & 7) << 3 | (base & 7));
+			d(unsigned(disp));
+		}
+	}
+
+	// ModRM for a register operand
+	void rr(int reg, int rm) { b(0xC0 | (reg & 7) << 3 | (rm & 7)); }
+
+	// <op> r8, [base + disp] or <op> [base + disp], r8
+	void op8(unsigned op, int reg, int base, long disp) { rex(false, reg, base); b(op); mem(reg, base, disp); }
+
+	// movzx r32, byte/word [base + disp]
+	void movzxb(int reg, int base, long disp) { rex(false, reg, base); b(0x0F); b(0xB6); mem(reg, base, disp); }
+	void movzxw(int reg, int base, long disp) { rex(false, reg, base); b(0x0F); b(0xB7); mem(reg, base, disp); }
+
+	// mov word [base + disp], r16 / imm16
+	void store16(int reg, int base, long disp) { b(0x66); rex(false, reg, base); b(0x89); mem(reg, base, disp); }
+	void store16i(int base, long disp, unsigned imm) { b(0x66); rex(false, 0, base); b(0xC7); mem(0, base, disp); w(imm); }
+
+	// <op> byte [base + disp], imm8 (op selects the /digit of opcode 0x80)
+	void alu8i(int digit, int base, long disp, unsigned imm) { rex(false, 0, base); b(0x80); mem(digit, base, disp); b(imm); }
+
+	void setcc(int cc, int reg) { rex(false, 0, reg); b(0x0F); b(0x90 | cc); rr(0, reg); }
+	void cmovcc(int cc, int reg, int rm) { rex(false, reg, rm); b(0x0F); b(0x40 | cc); rr(reg, rm); }
+
+	// mov r32, imm32
+	void movi(int reg, unsigned imm) { rex(false, 0, reg); b(0xB8 | (reg & 7)); d(imm); }
+
+	// Wraps eax to 12 bits
+	void wrap12()
+	{
+		b(0x25); d(mem::pcMask);	// and eax, 0xFFF
+	}
+};
+
+static unsigned char* allocCode()
+{
+#ifdef _WIN32
+	return static_cast<unsigned char*>(VirtualAlloc(nullptr, CODE_SIZE,
+		MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE));
+#else
+	void* p = mmap(nullptr, CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return p == MAP_FAILED ? nullptr : static_cast<unsigned char*>(p);
+#endif
+}
+
+static void freeCode(unsigned char* code)
+{
+	if (!code) { return; }
+#ifdef _WIN32
+	VirtualFree(code, 0, MEM_RELEASE);
+#else
+	munmap(code, CODE_SIZE);
+#endif
+}
+
+chip8Jit::chip8Jit(const layout& l) : regs(l), code(allocCode()), used(0)
+{
+	flush();
+}
+
+chip8Jit::~chip8Jit()
+{
+	freeCode(code);
+}
+
+void chip8Jit::flush()
+{
+	std::memset(blocks, 0, sizeof blocks);
+	std::memset(covered, 0, sizeof covered);
+	used = 0;
+}
+
+const chip8Jit::block& chip8Jit::lookup(unsigned short pc)
+{
+	if (!blocks[pc].end)
+		compile(pc);
+	return blocks[pc];
+}
+
+void chip8Jit::drop(unsigned short start)
+{
+	for (unsigned a = start; a < blocks[start].end; a++)
+		--covered[a];
+	blocks[start].end = 0;
+}
+
+void chip8Jit::invalidate(unsigned addr, unsigned len)
+{
+	for (unsigned a = addr; a < addr + len && a < 0x1000; a++)
+	{
+		if (!covered[a]) { continue; }
+
+		// A block is at most maxBlockLength instructions long,
+		// plus the instruction after it when it ends in a skip
+		const unsigned span = 2 * maxBlockLength + 2;
+		unsigned first = a >= span ? a - span : 0;
+		for (unsigned s = first; s <= a; s++)
+		{
+			if (blocks[s].end && a < blocks[s].end)
+				drop((unsigned short)s);
+		}
+	}
+}
+
+void chip8Jit::compile(unsigned short start)
+{
+	const decodedOp* const table = decodeTable();
+	const unsigned char* const memory = regs.memory;
+
+	// Room for the prologue and at least one instruction
+	if (!code || CODE_SIZE - used < 2 * MAX_OP_BYTES)
+		flush();
+
+	emitter e = { code ? code + used : nullptr };
+	unsigned short addr = start;
+	unsigned short count = 0;
+	bool ended = false;		// Last instruction already stored PC
+	bool jumps = false;
+	bool skips = false;		// Ends in a skip, which depends on the next instruction
+
+	if (code)
+	{
+#ifndef _WIN32
+		// System V passes the arguments in rdi/rsi, blocks expect rcx/rdx like Win64
+		e.b(0x48); e.b(0x89); e.rr(7, RCX);	// mov rcx, rdi
+		e.b(0x48); e.b(0x89); e.rr(6, RDX);	// mov rdx, rsi
+#endif
+	}
+
+	while (code && !ended && count < maxBlockLength && addr + 2u <= mem::pcMask)
+	{
+		if (CODE_SIZE - size_t(e.p - code) < MAX_OP_BYTES) { break; }
+
+		const decodedOp& d = table[memory[addr] << 8 | memory[addr + 1]];
+		const unsigned next2 = (addr + 2) & mem::pcMask;
+		// A taken skip steps over F000 NNNN as a whole
+		const bool skipsLong = memory[next2] == 0xF0 && memory[next2 + 1] == 0x00;
+		const unsigned next4 = (next2 + (skipsLong ? 4 : 2)) & mem::pcMask;
+		const int x = d.x, y = d.y;
+
+		switch (d.kind)
+		{
+		case OP_LD_NN:
+			e.rex(false, 0, RDX); e.b(0xC6); e.mem(0, RDX, x); e.b(d.nn);	// mov byte [V+x], nn
+			break;
+		case OP_ADD_NN:
+			e.alu8i(0, RDX, x, d.nn);	// add byte [V+x], nn
+			break;
+		case OP_LD_XY:
+		case OP_OR:
+		case OP_AND:
+		case OP_XOR:
+		{
+			static const unsigned ops[] = { 0x88, 0x08, 0x20, 0x30 };	// mov, or, and, xor
+			e.op8(0x8A, RAX, RDX, y);							// mov al, [V+y]
+			e.op8(ops[d.kind - OP_LD_XY], RAX, RDX, x);		// <op> [V+x], al
+			break;
+		}
+		// VF is written before VX is updated, like in decodeOpcode,
+		// so the results stay exact when X or Y is F
+		case OP_ADD_XY:
+			e.op8(0x8A, RAX, RDX, y);	// mov al, [V+y]
+			e.op8(0x02, RAX, RDX, x);	// add al, [V+x]
+			e.setcc(0x2, R9);			// setc r9b
+			e.op8(0x88, R9, RDX, 0xF);	// mov [V+F], r9b
+			e.op8(0x8A, RAX, RDX, y);	// mov al, [V+y]
+			e.op8(0x00, RAX, RDX, x);	// add [V+x], al
+			break;
+		case OP_SUB:
+			e.op8(0x8A, RAX, RDX, x);	// mov al, [V+x]
+			e.op8(0x3A, RAX, RDX, y);	// cmp al, [V+y]
+			e.setcc(CC_AE, R9);			// VF = VX >= VY
+			e.op8(0x88, R9, RDX, 0xF);
+			e.op8(0x8A, RAX, RDX, y);	// mov al, [V+y]
+			e.op8(0x28, RAX, RDX, x);	// sub [V+x], al
+			break;
+		case OP_SHR:
+			e.op8(0x8A, RAX, RDX, x);	// mov al, [V+x]
+			e.b(0x24); e.b(0x01);		// and al, 1
+			e.op8(0x88, RAX, RDX, 0xF);	// mov [V+F], al
+			e.b(0xD0); e.mem(5, RDX, x);	// shr byte [V+x], 1
+			break;
+		case OP_SUBN:
+			e.op8(0x8A, RAX, RDX, y);	// mov al, [V+y]
+			e.op8(0x3A, RAX, RDX, x);	// cmp al, [V+x]
+			e.setcc(CC_AE, R9);			// VF = VY >= VX
+			e.op8(0x88, R9, RDX, 0xF);
+			e.op8(0x8A, RAX, RDX, y);	// mov al, [V+y]
+			e.op8(0x2A, RAX, RDX, x);	// sub al, [V+x]
+			e.op8(0x88, RAX, RDX, x);	// mov [V+x], al
+			break;
+		case OP_SHL:
+			e.op8(0x8A, RAX, RDX, x);			// mov al, [V+x]
+			e.b(0xC0); e.rr(5, RAX); e.b(7);	// shr al, 7
+			e.op8(0x88, RAX, RDX, 0xF);			// mov [V+F], al
+			e.b(0xD0); e.mem(4, RDX, x);		// shl byte [V+x], 1
+			break;
+		case OP_LD_I:
+			e.store16i(RCX, regs.I, d.nnn);
+			break;
+		case OP_ADD_I:
+			// XO-CHIP's 16-bit I is left to the interpreter
+			if (*regs.mode == MODE_XOCHIP) { goto done; }
+			e.movzxb(R9, RDX, x);					// r9d = VX
+			e.movzxw(RAX, RCX, regs.I);				// eax = I
+			e.movi(R8, 0xFFF);
+			e.rex(false, RAX, R8); e.b(0x29); e.rr(RAX, R8);	// sub r8d, eax
+			e.rex(false, R8, R9); e.b(0x39); e.rr(R8, R9);		// cmp r9d, r8d
+			e.setcc(CC_A, R9);						// VF = VX > 0xFFF - I
+			e.op8(0x88, R9, RDX, 0xF);
+			e.movzxb(R9, RDX, x);					// VX again, it may be VF
+			e.rex(false, R9, RAX); e.b(0x01); e.rr(R9, RAX);	// add eax, r9d
+			e.wrap12();
+			e.store16(RAX, RCX, regs.I);
+			break;
+		case OP_LD_F:
+			e.movzxb(RAX, RDX, x);
+			e.b(0x8D); e.b(0x04); e.b(0x80);		// lea eax, [rax + rax * 4]
+			e.store16(RAX, RCX, regs.I);
+			break;
+		case OP_LOAD:
+			e.movzxw(RAX, RCX, regs.I);
+			e.rex(true, 0, R8); e.b(0xB8 | (R8 & 7)); e.q((unsigned long long)memory);	// mov r8, memory
+			e.rex(true, RAX, R8); e.b(0x01); e.rr(RAX, R8);	// add r8, rax
+			for (int r = 0; r <= x; r++)
+			{
+				e.op8(0x8A, R9, R8, r);		// mov r9b, [r8 + r]
+				e.op8(0x88, R9, RDX, r);	// mov [V+r], r9b
+			}
+			break;
+
+		// Control flow ends the block
+		case OP_SE_NN:
+		case OP_SNE_NN:
+		case OP_SE_XY:
+		case OP_SNE_XY:
+			e.movi(RAX, next2);
+			e.movi(R8, next4);
+			if (d.kind == OP_SE_NN || d.kind == OP_SNE_NN)
+			{
+				e.alu8i(7, RDX, x, d.nn);	// cmp byte [V+x], nn
+			}
+			else
+			{
+				e.op8(0x8A, R9, RDX, y);	// mov r9b, [V+y]
+				e.op8(0x38, R9, RDX, x);	// cmp [V+x], r9b
+			}
+			e.cmovcc(d.kind == OP_SE_NN || d.kind == OP_SE_XY ? CC_E : CC_NE, RAX, R8);
+			e.store16(RAX, RCX, regs.pc);
+			ended = skips = true;
+			break;
+		case OP_JP:
+			e.store16i(RCX, regs.pc, d.nnn);
+			ended = jumps = true;
+			break;
+		case OP_JP_V0:
+			e.movzxb(RAX, RDX, 0);
+			e.b(0x05); e.d(d.nnn);		// add eax, nnn
+			e.wrap12();
+			e.store16(RAX, RCX, regs.pc);
+			ended = true;
+			break;
+		case OP_CALL:
+			e.movzxw(RAX, RCX, regs.sp);
+			e.b(0x66); e.b(0xC7); e.b(0x84); e.b(0x41);	// mov word [rcx + rax * 2 + stack], addr
+			e.d(unsigned(regs.stack)); e.w(addr);
+			e.b(0xFF); e.rr(0, RAX);					// inc eax
+			e.op8(0x8D, R8, RAX, -15);					// lea r8d, [rax - 15]
+			e.b(0x83); e.rr(7, RAX); e.b(15);			// cmp eax, 15
+			e.cmovcc(CC_AE, RAX, R8);					// sp = (sp + 1) % 0xF
+			e.store16(RAX, RCX, regs.sp);
+			e.store16i(RCX, regs.pc, d.nnn);
+			ended = true;
+			break;
+		case OP_RET:
+			e.movzxw(RAX, RCX, regs.sp);
+			e.b(0xFF); e.rr(1, RAX);					// dec eax
+			e.b(0x83); e.rr(4, RAX); e.b(0x0F);		// and eax, 0xF
+			e.store16(RAX, RCX, regs.sp);
+			e.b(0x0F); e.b(0xB7); e.b(0x84); e.b(0x41);	// movzx eax, word [rcx + rax * 2 + stack]
+			e.d(unsigned(regs.stack));
+			e.b(0x83); e.rr(0, RAX); e.b(2);			// add eax, 2
+			e.wrap12();
+			e.store16(RAX, RCX, regs.pc);
+			ended = true;
+			break;
+
+		default:
+			// Left to the interpreter
+			goto done;
+		}
+
+		addr += 2;
+		count++;
+	}
+done:
+
+	block& b = blocks[start];
+	b.count = count;
+	b.jumps = jumps;
+	if (count)
+	{
+		if (!ended) { e.store16i(RCX, regs.pc, addr); }
+		e.b(0xC3);	// ret
+		b.fn = reinterpret_cast<blockFn>(code + used);
+		b.end = skips ? std::min(addr + 2, 0x1000) : addr;
+		used = e.p - code;
+	}
+	else
+	{
+		// Remember that this address has to be interpreted
+		b.fn = nullptr;
+		b.end = std::min(start + 2, 0x1000);
+	}
+
+	for (unsigned a = start; a < b.end; a++)
+		++covered[a];
+}
+
+// Same contract as emulateCycle
+bool chip8::runJit(short cycles, bool force)
+{
+	if (!jit)
+	{
+		chip8Jit::layout l;
+		auto base = reinterpret_cast<char*>(this);
+		l.I = reinterpret_cast<char*>(&I) - base;
+		l.pc = reinterpret_cast<char*>(&pc) - base;
+		l.sp = reinterpret_cast<char*>(&sp) - base;
+		l.stack = reinterpret_cast<char*>(stack) - base;
+		l.memory = memory;
+		l.mode = &mode;
+		jit.reset(new chip8Jit(l));
+	}
+
+	for (auto i = 0; i < cycles;)
+	{
+		if (!isRunning & !force) { break; }
+
+		// Blocks never trace, so tracing and profiling
+		// run everything through the interpreter
+		const auto from = pc;
+		if (!observed() && pc <= mem::pcMask)
+		{
+			const auto& b = jit->lookup(pc);
+			if (b.fn && b.count <= cycles - i)
+			{
+				b.fn(this, V);
+				if (b.jumps && detInfLoop()) { return false; }
+				i += b.count;
+
+				// Looping back may be a spin loop
+				const unsigned last = from + 2 * (b.count - 1);
+				if (b.jumps && pc <= last && (memory[last] & 0xF0) == 0x10)
+					i += idleLoop(last, i, cycles - i);
+				continue;
+			}
+		}
+
+		// Interpret a single instruction, its stores
+		// throw away the blocks they overwrite
+		if (!runTable(1, force)) { return false; }
+		i++;
+
+		if ((opcode & 0xF000) == 0x1000 && pc <= from)
+			i += idleLoop(from, i, cycles - i);
+	}
+	return true;
+}
+
+#else
+
+bool chip8::runJit(short cycles, bool force)
+{
+	return runTable(cycles, force);
+}
+
+#endif
@@ -0,0 +1,82 @@
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#ifndef JIT_H
+#define JIT_H
+
+#include <cstddef>
+
+#include "chip8-memory.h"
+
+// The recompiler emits x86-64 machine code, everywhere else
+// BACKEND_JIT quietly runs on the table interpreter instead
+#if (defined(__x86_64__) || defined(_M_X64)) && !defined(CHIP8_NO_JIT)
+#define CHIP8_JIT 1
+#else
+#define CHIP8_JIT 0
+#endif
+
+// Translates straight-line runs of instructions (basic blocks) into
+// native code and caches them by start address.
+//
+// A block stops at the first control flow instruction (1NNN, 2NNN, 00EE,
+// BNNN and the skips), which is compiled as its last instruction,
+// or right before anything the recompiler leaves to the interpreter:
+// DXYN, FX0A, CXNN, the key skips, timer access and memory stores.
+class chip8Jit
+{
+public:
+	// Compiled code gets the machine state base and V,
+	// and leaves the next PC in the state
+	typedef void (*blockFn)(void* base, unsigned char* V);
+
+	struct block
+	{
+		blockFn fn;				//nullptr: the first instruction must be interpreted
+		unsigned short end;		//First address after the block, 0 if not compiled yet.
+								//Covers the instruction after a final skip too,
+								//whether it is F000 NNNN decides where the skip lands.
+		unsigned short count;	//Instructions executed by one run of the block
+		bool jumps;				//Ends in 1NNN, so the infinite loop check must follow
+	};
+
+	// Where the registers live, as byte offsets from the base
+	// handed to blocks (the chip8 object) plus the RAM address.
+	// The mode is read when compiling, changing it must flush().
+	struct layout
+	{
+		ptrdiff_t I, pc, sp, stack;
+		const unsigned char* memory;
+		const chip8Mode* mode;
+	};
+
+	static const unsigned maxBlockLength = 64;
+
+	explicit chip8Jit(const layout& l);
+	~chip8Jit();
+
+	chip8Jit(const chip8Jit&) = delete;
+	chip8Jit& operator=(const chip8Jit&) = delete;
+
+	// Returns the block starting at pc, compiling it on first use
+	const block& lookup(unsigned short pc);
+
+	// Drops every block containing a byte in [addr, addr + len)
+	void invalidate(unsigned addr, unsigned len);
+
+	// Drops everything, e.g. after a new ROM was loaded
+	void flush();
+
+private:
+	layout regs;
+	unsigned char* code;	//Executable arena
+	size_t used;
+
+	block blocks[0x1000];
+	unsigned char covered[0x1000];	//How many blocks include each byte
+
+	void compile(unsigned short pc);
+	void drop(unsigned short start);
+};
+#endif
@@ -5,20 +5,16 @@
 Chip 8's memory map:
 
 0x000 - 0x1FF - Chip 8 interpreter(contains font set in emu)
-0x050 - 0x0A0 - Used for the built in 4x5 pixel font set(0 - F)
+0x000 - 0x04F - Used for the built in 4x5 pixel font set(0 - F)
+0x050 - 0x0EF - Used for the SUPER-CHIP 8x10 pixel font set(0 - F)
 0x200 - 0xFFF - Program ROM and work RAM
+0x1000 - 0xFFFF - XO-CHIP data, reachable through I only
+0x1000 / 0x10000 - Mirror of 0x000 - 0x03F after the 4K / 64K address space
 */
 
-//Go to the header for details on the variables here
-
 namespace mem
 {
-	bool key[16];
-	unsigned char
-		memory[4096],
-		V[16],
-		pixels[64 * 32];
-	static const unsigned char
+	const unsigned char
 		chip8_fontset[80] =
 		{
 			0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
@@ -38,19 +34,75 @@ namespace mem
 			0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
 			0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 		};
+
+	const unsigned char
+		schip_fontset[160] =
+		{
+			0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+			0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+			0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+			0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+			0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+			0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+			0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+			0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+			0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+			0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+			0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+			0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+			0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+			0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+			0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+			0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+		};
+}
+
+//The start of RAM again after its end, for reads that run past it
+void mem::mirror(unsigned char* ram, unsigned mask)
+{
+	std::copy_n(ram, mirrorSize, ram + mask + 1);
+}
+
+unsigned mem::syncMirror(unsigned char* ram, unsigned mask, unsigned addr, unsigned len)
+{
+	const unsigned end = mask + 1;
+	const unsigned wrapped = addr + len > end ? addr + len - end : 0;
+	std::copy_n(ram + end, wrapped, ram);
+	if (wrapped || addr < mirrorSize) { mirror(ram, mask); }
+	return wrapped;
+}
+
+void chip8State::seed(uint64_t s)
+{
+	// splitmix64, so that nearby seeds give unrelated
+	// sequences and no seed leaves xorshift stuck at zero
+	s += 0x9E3779B97F4A7C15ULL;
+	s = (s ^ (s >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	s = (s ^ (s >> 27)) * 0x94D049BB133111EBULL;
+	s ^= s >> 31;
+	rng = s ? s : 1;
 }
 
 //Initialize everything
-void initMem() {
+void chip8State::initMem() {
 
 	// Use fill_n instead of array[x] = { 0 }
 	// to prevent buffer overrun
-	std::fill_n(mem::memory, 4096, 0);
-	std::fill_n(mem::V, 16, 0);
-	std::fill_n(mem::pixels, 64 * 32, 0);
-	std::fill_n(mem::key, 16, false);
+	std::fill_n(memory, sizeof memory, 0);
+	std::fill_n(V, 16, 0);
+	std::fill_n(&pixels[0][0], 2 * 64 * 2, 0);
+	std::fill_n(key, 16, false);
+	std::fill_n(flags, 16, 0);
+	std::fill_n(pattern, 16, 0xF0);
+	hires = false;
+	planes = 1;
+	pitch = 64;
+	seed(0);
 
-	// Load fontset
+	// Load fontsets
 	for (int i = 0; i < 80; ++i)
-		mem::memory[i] = mem::chip8_fontset[i];
+		memory[mem::fontAddr + i] = mem::chip8_fontset[i];
+	for (int i = 0; i < 160; ++i)
+		memory[mem::bigFontAddr + i] = mem::schip_fontset[i];
+	mirror();
 }
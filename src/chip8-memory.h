@@ -5,24 +5,149 @@
 #ifndef MEMORY_H
 #define MEMORY_H
 
-extern void initMem();
+#include <cstdint>
+#include <type_traits>
 
 namespace mem
 {
-	//4K of RAM
-	extern unsigned char	memory[4096];
+	//Fontset
+	extern const unsigned char
+							chip8_fontset[80];
+
+	//SUPER-CHIP 8x10 digits (FX30), XO-CHIP adds A - F
+	extern const unsigned char
+							schip_fontset[160];
+
+	//Where the fonts are loaded
+	const unsigned short	fontAddr = 0x000;
+	const unsigned short	bigFontAddr = 0x050;
+
+	//Addresses wrap at a power of two, so wrapping is a mask. PC and
+	//I are 12-bit (4K), I is 16-bit (64K) on XO-CHIP.
+	const unsigned			pcMask = 0xFFF;
+	const unsigned			smallMask = 0xFFF;
+	const unsigned			largeMask = 0xFFFF;
+
+	//The address space is followed by a copy of its first bytes, so
+	//anything that reads or writes a run of bytes from an address near
+	//the end (an instruction, a sprite, FX55, FX65...) wraps around
+	//without a check per byte. A two plane 16x16 sprite is the longest.
+	const unsigned			mirrorSize = 64;
+
+	//Copies the first mirrorSize bytes of RAM over the mirror after
+	//an address space of mask + 1 bytes
+	void mirror(unsigned char* ram, unsigned mask);
+
+	//Keeps the mirror in step after a store of len bytes at addr
+	//(up to mask). What ran on into the mirror is copied to the
+	//start, returns how many bytes that was.
+	unsigned syncMirror(unsigned char* ram, unsigned mask, unsigned addr, unsigned len);
+}
+
+//Which instruction set a ROM was written for. Every machine runs the
+//opcodes of all three, the mode only decides where they disagree:
+//XO-CHIP has a 16-bit I (FX1E, FX33), SUPER-CHIP counts the colliding
+//rows of a hi-res sprite in VF.
+enum chip8Mode : unsigned char
+{
+	MODE_CHIP8,
+	MODE_SCHIP,
+	MODE_XOCHIP
+};
+
+//Everything one machine is made of. It is plain data, so
+//a machine can be copied, saved or restored with memcpy.
+struct chip8State
+{
+	//4K of RAM, 64K for XO-CHIP, followed by the mirror of its start
+	//(see mem::mirrorSize). In the 4K modes the mirror takes the place
+	//of the first XO-CHIP bytes at 0x1000. Code always runs from the
+	//first 4K, only I reaches further; an instruction at 0xFFF reads
+	//its second byte from 0x1000, the mirror or XO-CHIP RAM.
+	unsigned char	memory[mem::largeMask + 1 + mem::mirrorSize];
 
 	//15 registers + 1 carry flag
-	extern unsigned char	V[16];
+	unsigned char	V[16];
+
+	unsigned short
+		stack[16],	//16-level Stack
+		sp,			//Stack pointer
+		opcode,		//Current opcode
+		I,			//Index register
+		pc;			//Program counter
+
+	unsigned char
+		delay_timer,   	//These 2 registers when set above zero,
+						//they will count down to it at 60Hz
+		sound_timer;	//When the sound timer reaches zero, the buzzer sounds
 
-	//Pixel state
-	extern unsigned char	pixels[64 * 32];
+	//Pixel state of the two XO-CHIP bitplanes, one bit per pixel,
+	//the leftmost pixel is the most significant bit. In lo-res (64x32)
+	//every row is one word, pixels[p][y]. In hi-res (128x64) it is two,
+	//pixels[p][2 * y] for the left half and pixels[p][2 * y + 1] for the right.
+	uint64_t		pixels[2][64 * 2];
+
+	bool			hires;		//128x64 (00FF) instead of 64x32 (00FE)
+	unsigned char	planes;		//Bitplanes that draws and scrolls affect (FN01)
+	chip8Mode		mode;
+
+	//SUPER-CHIP user flags (FX75, FX85), XO-CHIP has 16 of them
+	unsigned char	flags[16];
+
+	//XO-CHIP audio: a 1-bit sample pattern (F002) played at
+	//4000 * 2^((pitch - 64) / 48) bits per second (FX3A).
+	//It starts out as a 500Hz square wave, the CHIP-8 buzzer.
+	unsigned char	pattern[16];
+	unsigned char	pitch;
 
 	//State of the keypad
-	extern  bool			key[16];
+	bool			key[16];
 
-	//Fontset
-	extern const unsigned char
-							chip8_fontset[80];
-}
+	//Generator behind CXNN (xorshift64*). It is part of the state
+	//so every machine draws its own numbers, and saved states and
+	//input replays see the same ones again. Never zero.
+	uint64_t		rng;
+
+	bool drawFlag;
+	bool waitForKey;
+
+	void initMem();
+
+	//Mask of the address space I and memory accesses through it wrap in
+	unsigned addrMask() const { return mode == MODE_XOCHIP ? mem::largeMask : mem::smallMask; }
+
+	//Refreshes the mirror, after the start of RAM or the mode changed
+	void mirror() { mem::mirror(memory, addrMask()); }
+
+	//Restarts the generator, the same seed gives the same numbers
+	void seed(uint64_t s);
+
+	//Next random byte from a generator
+	static unsigned char random(uint64_t& state)
+	{
+		state ^= state >> 12;
+		state ^= state << 25;
+		state ^= state >> 27;
+		return (state * 0x2545F4914F6CDD1DULL) >> 56;
+	}
+
+	//There are no keys above F, EX9E and EXA1 see them as released
+	bool keyDown(unsigned char k) const
+	{
+		return k < 16 && key[k];
+	}
+
+	unsigned width() const { return hires ? 128 : 64; }
+	unsigned height() const { return hires ? 64 : 32; }
+
+	//Unpacks a single pixel, for renderers and debug views
+	bool pixel(unsigned x, unsigned y, unsigned plane = 0) const
+	{
+		const uint64_t row = hires ? pixels[plane][2 * y + (x >> 6)] : pixels[plane][y];
+		return (row >> (63 - (x & 63))) & 1;
+	}
+};
+
+static_assert(std::is_trivially_copyable<chip8State>::value,
+	"chip8State must stay plain data");
 #endif
@@ -0,0 +1,140 @@
+#include <algorithm>
+#include <istream>
+#include <ostream>
+
+#include "chip8-movie.h"
+
+static const char magic[4] = { 'C', '8', 'M', 'V' };
+static const unsigned char version = 1;
+
+static void putInt(std::ostream& out, uint64_t v, unsigned bytes)
+{
+	for (unsigned i = 0; i < bytes; i++)
+		out.put(char(v >> (8 * i)));
+}
+
+static bool getInt(std::istream& in, uint64_t& v, unsigned bytes)
+{
+	v = 0;
+	for (unsigned i = 0; i < bytes; i++)
+	{
+		const int c = in.get();
+		if (c == std::char_traits<char>::eof()) { return false; }
+		v |= uint64_t(c & 0xFF) << (8 * i);
+	}
+	return true;
+}
+
+static void putVarint(std::ostream& out, uint32_t v)
+{
+	while (v >= 0x80)
+	{
+		out.put(char(v | 0x80));
+		v >>= 7;
+	}
+	out.put(char(v));
+}
+
+static bool getVarint(std::istream& in, uint32_t& v)
+{
+	v = 0;
+	for (unsigned shift = 0; shift < 35; shift += 7)
+	{
+		const int c = in.get();
+		if (c == std::char_traits<char>::eof()) { return false; }
+		v |= uint32_t(c & 0x7F) << shift;
+		if (!(c & 0x80)) { return true; }
+	}
+	return false;
+}
+
+uint32_t chip8Movie::checksum(const unsigned char* rom, size_t size)
+{
+	uint32_t h = 2166136261u;
+	for (size_t i = 0; i < size; i++)
+		h = (h ^ rom[i]) * 16777619u;
+	return h;
+}
+
+void chip8Movie::clear()
+{
+	events.clear();
+	frameCount = 0;
+	restart();
+}
+
+void chip8Movie::restart()
+{
+	played = 0;
+	nextEvent = 0;
+	current = 0;
+}
+
+void chip8Movie::record(uint16_t keys)
+{
+	// The keypad starts out with every key up
+	const uint16_t last = events.empty() ? 0 : events.back().keys;
+	if (keys != last) { events.push_back({ frameCount, keys }); }
+	frameCount++;
+}
+
+uint16_t chip8Movie::next()
+{
+	if (nextEvent < events.size() && events[nextEvent].frame == played)
+		current = events[nextEvent++].keys;
+	if (played < frameCount) { played++; }
+	return current;
+}
+
+bool chip8Movie::save(std::ostream& out) const
+{
+	out.write(magic, sizeof magic);
+	out.put(char(version));
+	out.put(char(mode));
+	putInt(out, ips, 4);
+	putInt(out, seed, 8);
+	putInt(out, romSum, 4);
+	putInt(out, frameCount, 4);
+
+	uint32_t frame = 0;
+	for (auto& e : events)
+	{
+		putVarint(out, e.frame - frame);
+		putInt(out, e.keys, 2);
+		frame = e.frame;
+	}
+	return bool(out);
+}
+
+bool chip8Movie::load(std::istream& in)
+{
+	clear();
+
+	char m[4];
+	if (!in.read(m, sizeof m) || !std::equal(m, m + 4, magic)) { return false; }
+	if (in.get() != version) { return false; }
+
+	const int md = in.get();
+	if (md < MODE_CHIP8 || md > MODE_XOCHIP) { return false; }
+	mode = chip8Mode(md);
+
+	uint64_t v, s, sum, count;
+	if (!getInt(in, v, 4) || !getInt(in, s, 8) || !getInt(in, sum, 4) || !getInt(in, count, 4))
+		return false;
+	ips = uint32_t(v);
+	seed = s;
+	romSum = uint32_t(sum);
+
+	// Events run to the end of the file
+	uint32_t frame = 0, delta;
+	while (in.peek() != std::char_traits<char>::eof())
+	{
+		uint64_t keys;
+		if (!getVarint(in, delta) || !getInt(in, keys, 2)) { return false; }
+		frame += delta;
+		if (frame >= count || (!events.empty() && frame <= events.back().frame)) { return false; }
+		events.push_back({ frame, uint16_t(keys) });
+	}
+	frameCount = uint32_t(count);
+	return true;
+}
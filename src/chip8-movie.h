@@ -0,0 +1,73 @@
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include <cstdint>
+#include <iosfwd>
+#include <vector>
+
+#include "chip8-memory.h"
+
+// The keypad of a whole run, one state per frame (1/60s of emulated
+// time), to play a game back exactly as it was recorded.
+//
+// Everything else that decides what a machine does is in the header:
+// the ROM (as a checksum), the mode, the instructions per second and
+// the CXNN seed. Keys only change at the start of a frame while a movie
+// is recorded or played (see chip8Scheduler::setMovie), so the same
+// frames see the same keys on any backend.
+//
+// File layout, little endian:
+//   "C8MV", version, mode (1 byte each), instructions per second (4),
+//   seed (8), ROM checksum (4), frames (4),
+//   then one event per change of the keypad: frames since the previous
+//   event as a varint, followed by the 16 key bits (bit k is key k).
+class chip8Movie
+{
+public:
+	chip8Mode mode = MODE_CHIP8;
+	uint32_t ips = 700;
+	uint64_t seed = 0;
+	uint32_t romSum = 0;
+
+	// FNV-1a of the ROM as it was loaded
+	static uint32_t checksum(const unsigned char* rom, size_t size);
+
+	// Starts an empty recording
+	void clear();
+
+	// Recording side, the keys of the frame that starts now
+	void record(uint16_t keys);
+
+	// Replay side, the keys of the frame that starts now. The last
+	// recorded keys stay down after the end.
+	uint16_t next();
+	bool finished() const { return played >= frameCount; }
+
+	// Goes back to the first frame
+	void restart();
+
+	uint32_t frames() const { return frameCount; }
+
+	bool save(std::ostream& out) const;
+	// False if the file is no movie or is cut short
+	bool load(std::istream& in);
+
+private:
+	struct event
+	{
+		uint32_t frame;
+		uint16_t keys;
+	};
+	std::vector<event> events;
+	uint32_t frameCount = 0;
+
+	//Replay position
+	uint32_t played = 0;
+	size_t nextEvent = 0;
+	uint16_t current = 0;
+};
+#endif
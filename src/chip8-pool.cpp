@@ -0,0 +1,146 @@
+#include <algorithm>
+
+#include "chip8-pool.h"
+
+chip8Pool::chip8Pool(unsigned threadCount)
+{
+	if (!threadCount)
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+	for (unsigned i = 0; i < threadCount; i++)
+		queues.emplace_back(new taskQueue);
+
+	for (unsigned i = 1; i < threadCount; i++)
+		threads.emplace_back(&chip8Pool::workerLoop, this, i);
+}
+
+chip8Pool::~chip8Pool()
+{
+	{
+		std::lock_guard<std::mutex> l(lock);
+		quit = true;
+	}
+	wake.notify_all();
+
+	for (auto& t : threads)
+		t.join();
+}
+
+size_t chip8Pool::add()
+{
+	machines.emplace_back(new chip8);
+	machines.back()->initialize();
+	return machines.size() - 1;
+}
+
+void chip8Pool::run(unsigned frameCount, short cycles, const frameFn& callback)
+{
+	if (machines.empty()) { return; }
+
+	frames = frameCount;
+	cyclesPerFrame = cycles;
+	onFrame = &callback;
+
+	// Counted before any task can be seen: a worker that is still
+	// looking for work from the previous run may take one right away
+	{
+		std::lock_guard<std::mutex> l(lock);
+		remaining = machines.size();
+	}
+
+	// Deal the machines out round robin, stealing evens out the rest
+	for (size_t i = 0; i < machines.size(); i++)
+	{
+		auto& q = *queues[i % queues.size()];
+		std::lock_guard<std::mutex> l(q.lock);
+		q.tasks.push_back(i);
+	}
+
+	{
+		std::lock_guard<std::mutex> l(lock);
+		generation++;
+	}
+	wake.notify_all();
+
+	work(0);
+
+	std::unique_lock<std::mutex> l(lock);
+	idle.wait(l, [this] { return remaining == 0; });
+}
+
+void chip8Pool::workerLoop(unsigned self)
+{
+	unsigned seen = 0;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> l(lock);
+			wake.wait(l, [&] { return quit || generation != seen; });
+			if (quit) { return; }
+			seen = generation;
+		}
+		work(self);
+	}
+}
+
+void chip8Pool::work(unsigned self)
+{
+	size_t task;
+	while (take(self, task))
+	{
+		step(task);
+
+		std::lock_guard<std::mutex> l(lock);
+		if (--remaining == 0)
+			idle.notify_all();
+	}
+}
+
+// Own queue first (newest task), then the oldest task of any other queue
+bool chip8Pool::take(unsigned self, size_t& task)
+{
+	{
+		auto& q = *queues[self];
+		std::lock_guard<std::mutex> l(q.lock);
+		if (!q.tasks.empty())
+		{
+			task = q.tasks.back();
+			q.tasks.pop_back();
+			return true;
+		}
+	}
+
+	for (unsigned i = 1; i < queues.size(); i++)
+	{
+		auto& q = *queues[(self + i) % queues.size()];
+		std::lock_guard<std::mutex> l(q.lock);
+		if (!q.tasks.empty())
+		{
+			task = q.tasks.front();
+			q.tasks.pop_front();
+			return true;
+		}
+	}
+	return false;
+}
+
+void chip8Pool::step(size_t index)
+{
+	chip8& m = *machines[index];
+
+	for (unsigned f = 0; f < frames; f++)
+	{
+		// Stopped for good, as opposed to waiting for a key
+		// that the callback may still press
+		if (!m.isRunning && !m.waitForKey) { break; }
+
+		if (!m.emulateCycle(cyclesPerFrame))
+		{
+			m.stopEmulation();
+			break;
+		}
+		m.tickTimers();
+
+		if (*onFrame && !(*onFrame)(index, m, f)) { break; }
+	}
+}
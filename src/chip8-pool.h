@@ -0,0 +1,78 @@
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "chip8-cpu.h"
+
+// Runs many independent machines on all cores.
+//
+// Every machine is one task per run(). Each worker owns a queue and takes
+// tasks from its back, and once it is empty it steals from the front of
+// the other queues, so a few long sessions never leave cores idle.
+// Machines are stepped a frame at a time, between frames a callback
+// can feed them input or look at their screen.
+class chip8Pool
+{
+public:
+	// Called after every frame of every machine, on a worker thread.
+	// Returning false stops stepping that machine until the next run().
+	typedef std::function<bool(size_t index, chip8& machine, unsigned frame)> frameFn;
+
+	explicit chip8Pool(unsigned threads = 0);	//0: one worker per core
+	~chip8Pool();
+
+	chip8Pool(const chip8Pool&) = delete;
+	chip8Pool& operator=(const chip8Pool&) = delete;
+
+	// Adds an initialized machine, returns its index
+	size_t add();
+
+	chip8& operator[](size_t index) { return *machines[index]; }
+	size_t size() const { return machines.size(); }
+	unsigned workers() const { return unsigned(queues.size()); }
+
+	// Steps every machine for up to frames * cyclesPerFrame instructions,
+	// a frame is 1/60s of emulated time so the timers tick once after each.
+	// The calling thread works too and returns when all machines are done.
+	void run(unsigned frames, short cyclesPerFrame, const frameFn& onFrame = frameFn());
+
+private:
+	struct taskQueue
+	{
+		std::mutex lock;
+		std::deque<size_t> tasks;
+	};
+
+	std::vector<std::unique_ptr<chip8>> machines;
+	std::vector<std::unique_ptr<taskQueue>> queues;	//One per worker, [0] belongs to run()'s caller
+	std::vector<std::thread> threads;
+
+	std::mutex lock;
+	std::condition_variable wake;	//A run started or the pool is going away
+	std::condition_variable idle;	//The last task of a run finished
+	unsigned generation = 0;		//Number of run() calls so far
+	size_t remaining = 0;			//Tasks of the current run not finished yet
+	bool quit = false;
+
+	// The current run
+	unsigned frames = 0;
+	short cyclesPerFrame = 0;
+	const frameFn* onFrame = nullptr;
+
+	void workerLoop(unsigned self);
+	void work(unsigned self);
+	bool take(unsigned self, size_t& task);
+	void step(size_t index);
+};
+#endif
@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+#include "chip8-memory.h"
+#include "chip8-profile.h"
+
+chip8Profile::chip8Profile()
+{
+	clear();
+}
+
+void chip8Profile::clear()
+{
+	std::fill_n(addrHits, 0x1000, 0);
+	std::fill_n(kinds, OP_COUNT, 0);
+	std::fill_n(taken, OP_COUNT, 0);
+	rows = 0;
+	instructions = 0;
+
+	frames.assign(1, frame{ 0, 0x200, 0, 0 });
+	children.clear();
+	current = 0;
+}
+
+void chip8Profile::enter(unsigned short addr)
+{
+	if (frames[current].depth == 16) { return; }
+
+	const uint32_t key = uint32_t(current) << 12 | addr;
+	auto found = children.find(key);
+	if (found == children.end())
+	{
+		found = children.emplace(key, unsigned(frames.size())).first;
+		frames.push_back(frame{ current, addr, frames[current].depth + 1, 0 });
+	}
+	current = found->second;
+}
+
+void chip8Profile::record(unsigned short pc, unsigned short opcode, unsigned short next)
+{
+	const opKind kind = decodeTable()[opcode].kind;
+
+	instructions++;
+	addrHits[pc & 0xFFF]++;
+	kinds[kind]++;
+	frames[current].self++;
+
+	switch (kind)
+	{
+	case OP_SE_NN: case OP_SNE_NN: case OP_SE_XY:
+	case OP_SNE_XY: case OP_SKP: case OP_SKNP:
+		// Not taken is a single advancePC
+		if (next != ((pc + 2) & mem::pcMask)) { taken[kind]++; }
+		break;
+	case OP_DRW:
+		rows += (opcode & 0x000F) ? (opcode & 0x000F) : 16;
+		break;
+	case OP_CALL:
+		enter(next);
+		break;
+	case OP_RET:
+		current = frames[current].parent;
+		break;
+	default:
+		break;
+	}
+}
+
+void chip8Profile::writeReport(std::ostream& out, const chip8State& s) const
+{
+	char line[160];
+	const double total = instructions ? double(instructions) : 1.0;
+
+	snprintf(line, sizeof line, "%llu instructions\n\n", (unsigned long long)instructions);
+	out << line;
+
+	// Opcode kinds, most executed first
+	std::vector<unsigned> order;
+	for (unsigned k = 0; k < OP_COUNT; k++)
+		if (kinds[k]) { order.push_back(k); }
+	std::sort(order.begin(), order.end(), [&](unsigned a, unsigned b) { return kinds[a] > kinds[b]; });
+
+	out << "kind          count       %\n";
+	for (auto k : order)
+	{
+		snprintf(line, sizeof line, "%-6s %12llu %7.2f\n", kindName(opKind(k)),
+			(unsigned long long)kinds[k], 100.0 * kinds[k] / total);
+		out << line;
+	}
+
+	out << "\nskip          taken   not taken\n";
+	for (auto k : { OP_SE_NN, OP_SNE_NN, OP_SE_XY, OP_SNE_XY, OP_SKP, OP_SKNP })
+	{
+		snprintf(line, sizeof line, "%-6s %12llu %11llu\n", kindName(k),
+			(unsigned long long)skipsTaken(k), (unsigned long long)skipsNotTaken(k));
+		out << line;
+	}
+
+	snprintf(line, sizeof line, "\n%llu draws, %llu sprite rows\n\n",
+		(unsigned long long)draws(), (unsigned long long)rows);
+	out << line;
+
+	// Every executed address with its code, gaps are marked
+	const uint64_t hottest = *std::max_element(addrHits, addrHits + 0x1000);
+	out << "addr  code  instruction           count       %\n";
+	int last = -1;
+	for (unsigned a = 0; a < 0x1000; a++)
+	{
+		if (!addrHits[a]) { continue; }
+		if (last >= 0 && a > unsigned(last) + 2) { out << "...\n"; }
+		last = int(a);
+
+		const unsigned short opcode = s.memory[a] << 8 | s.memory[a + 1];
+		char text[32];
+		disassemble(opcode, text, sizeof text);
+
+		const std::string bar(size_t(20 * addrHits[a] / hottest), '#');
+		snprintf(line, sizeof line, "%03X   %04X  %-16s %10llu %7.2f%s%s\n", a, opcode, text,
+			(unsigned long long)addrHits[a], 100.0 * addrHits[a] / total, bar.empty() ? "" : "  ", bar.c_str());
+		out << line;
+	}
+}
+
+void chip8Profile::writeCollapsed(std::ostream& out) const
+{
+	std::vector<unsigned> path;
+	for (unsigned f = 0; f < frames.size(); f++)
+	{
+		if (!frames[f].self) { continue; }
+
+		path.clear();
+		for (unsigned i = f; i; i = frames[i].parent)
+			path.push_back(i);
+
+		out << "main";
+		char name[16];
+		for (auto i = path.rbegin(); i != path.rend(); ++i)
+		{
+			snprintf(name, sizeof name, ";sub_%03X", frames[*i].addr);
+			out << name;
+		}
+		out << ' ' << frames[f].self << '\n';
+	}
+}
@@ -0,0 +1,75 @@
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <cstdint>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+#include "chip8-decode.h"
+
+struct chip8State;
+
+// Counts where a ROM spends its instructions.
+//
+// Filled by chip8 while profiling is on, through the same per-instruction
+// hooks as tracing, so it costs nothing when off and needs CHIP8_TRACE.
+// Calls and returns are followed on a shadow call stack, every
+// instruction is also counted for the subroutine it ran in. Like the
+// real stack it is 16 deep, calls past that count for the caller.
+class chip8Profile
+{
+public:
+	chip8Profile();
+
+	void clear();
+
+	// One executed instruction at pc, next is the PC after it
+	void record(unsigned short pc, unsigned short opcode, unsigned short next);
+
+	uint64_t total() const { return instructions; }
+	uint64_t hits(unsigned addr) const { return addrHits[addr & 0xFFF]; }
+	uint64_t kindCount(opKind kind) const { return kinds[kind]; }
+
+	// Only counted for the six skip instructions
+	uint64_t skipsTaken(opKind kind) const { return taken[kind]; }
+	uint64_t skipsNotTaken(opKind kind) const { return kinds[kind] - taken[kind]; }
+
+	uint64_t draws() const { return kinds[OP_DRW]; }
+	uint64_t drawRows() const { return rows; }
+
+	// Summary tables and a disassembly of every executed address
+	// annotated with its share of the instructions. The code is read
+	// from s, so pass the machine the profile was taken on.
+	void writeReport(std::ostream& out, const chip8State& s) const;
+
+	// One line per call stack, "main;sub_2A4;sub_31C 1234",
+	// the input format of flamegraph.pl and speedscope
+	void writeCollapsed(std::ostream& out) const;
+
+private:
+	struct frame
+	{
+		unsigned parent;		//Index of the caller, the root is its own parent
+		unsigned short addr;	//Subroutine entry, 0x200 for the root
+		unsigned depth;
+		uint64_t self;			//Instructions executed in it
+	};
+
+	uint64_t addrHits[0x1000];
+	uint64_t kinds[OP_COUNT];
+	uint64_t taken[OP_COUNT];
+	uint64_t rows;
+	uint64_t instructions;
+
+	std::vector<frame> frames;
+	std::unordered_map<uint32_t, unsigned> children;	//parent << 12 | addr -> frame
+	unsigned current;
+
+	void enter(unsigned short addr);
+};
+#endif
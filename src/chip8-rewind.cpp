@@ -0,0 +1,166 @@
+#include <cstring>
+
+#include "chip8-rewind.h"
+
+// A delta is a list of (equal bytes, changed bytes, XOR of the
+// changed bytes) runs, the counts are LEB128 varints. Trailing
+// equal bytes are not stored.
+
+static unsigned char* putVarint(unsigned char* out, size_t v)
+{
+	while (v >= 0x80)
+	{
+		*out++ = (unsigned char)(v | 0x80);
+		v >>= 7;
+	}
+	*out++ = (unsigned char)v;
+	return out;
+}
+
+static const unsigned char* getVarint(const unsigned char* in, size_t& v)
+{
+	v = 0;
+	for (unsigned shift = 0;; shift += 7)
+	{
+		const unsigned char b = *in++;
+		v |= size_t(b & 0x7F) << shift;
+		if (!(b & 0x80)) { return in; }
+	}
+}
+
+size_t encodeDelta(const unsigned char* a, const unsigned char* b, size_t size, unsigned char* out)
+{
+	unsigned char* const start = out;
+	size_t pos = 0;
+
+	for (;;)
+	{
+		// Most of a frame's state is unchanged, skip it a word at a time
+		const size_t equalFrom = pos;
+		while (pos + 8 <= size)
+		{
+			unsigned long long x, y;
+			std::memcpy(&x, a + pos, 8);
+			std::memcpy(&y, b + pos, 8);
+			if (x != y) { break; }
+			pos += 8;
+		}
+		while (pos < size && a[pos] == b[pos]) { pos++; }
+		if (pos == size) { break; }
+
+		// A changed run ends at the first two equal bytes in a row,
+		// a single equal byte costs less inside the run than a new run
+		const size_t changedFrom = pos;
+		while (pos < size && (a[pos] != b[pos] || (pos + 1 < size && a[pos + 1] != b[pos + 1])))
+			pos++;
+
+		out = putVarint(out, changedFrom - equalFrom);
+		out = putVarint(out, pos - changedFrom);
+		for (auto i = changedFrom; i < pos; i++)
+			*out++ = a[i] ^ b[i];
+	}
+	return out - start;
+}
+
+void applyDelta(const unsigned char* delta, size_t deltaSize, unsigned char* state)
+{
+	const unsigned char* const end = delta + deltaSize;
+	while (delta < end)
+	{
+		size_t equal, changed;
+		delta = getVarint(delta, equal);
+		delta = getVarint(delta, changed);
+		state += equal;
+		for (size_t i = 0; i < changed; i++)
+			*state++ ^= *delta++;
+	}
+}
+
+rewindBuffer::rewindBuffer(size_t bytes, unsigned maxFrames)
+	: data(bytes), records(maxFrames), scratch(2 * sizeof(chip8State) + 16)
+{
+	clear();
+}
+
+void rewindBuffer::clear()
+{
+	first = 0;
+	count = 0;
+	hasCurrent = false;
+}
+
+size_t rewindBuffer::bytesUsed() const
+{
+	size_t used = 0;
+	for (unsigned i = 0; i < count; i++)
+		used += records[(first + i) % records.size()].size;
+	return used;
+}
+
+void rewindBuffer::dropOldest()
+{
+	first = (first + 1) % records.size();
+	count--;
+}
+
+// Finds room for a record after the newest one, dropping
+// the oldest ones until it fits
+size_t rewindBuffer::reserve(size_t size)
+{
+	if (count == records.size()) { dropOldest(); }
+
+	for (;;)
+	{
+		if (!count) { return 0; }
+
+		const record& newest = records[(first + count - 1) % records.size()];
+		const size_t start = records[first].offset;
+		const size_t end = newest.offset + newest.size;
+
+		if (start < end)
+		{
+			// In use: [start, end)
+			if (end + size <= data.size()) { return end; }
+			if (size <= start) { return 0; }
+		}
+		else
+		{
+			// In use: [start, size) and [0, end)
+			if (end + size <= start) { return end; }
+		}
+		dropOldest();
+	}
+}
+
+void rewindBuffer::push(const chip8State& s)
+{
+	if (!hasCurrent)
+	{
+		std::memcpy(&current, &s, sizeof current);
+		hasCurrent = true;
+		return;
+	}
+
+	const size_t size = encodeDelta(reinterpret_cast<const unsigned char*>(&current),
+		reinterpret_cast<const unsigned char*>(&s), sizeof current, scratch.data());
+	if (size > data.size()) { clear(); push(s); return; }
+
+	const size_t offset = reserve(size);
+	std::memcpy(data.data() + offset, scratch.data(), size);
+	records[(first + count) % records.size()] = { offset, size };
+	count++;
+
+	std::memcpy(&current, &s, sizeof current);
+}
+
+bool rewindBuffer::pop(chip8State& s)
+{
+	if (!count) { return false; }
+
+	const record& newest = records[(first + count - 1) % records.size()];
+	applyDelta(data.data() + newest.offset, newest.size, reinterpret_cast<unsigned char*>(&current));
+	count--;
+
+	std::memcpy(&s, &current, sizeof s);
+	return true;
+}
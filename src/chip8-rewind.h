@@ -0,0 +1,63 @@
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <cstddef>
+#include <vector>
+
+#include "chip8-memory.h"
+
+// Remembers one machine state per frame so play can be rewound.
+//
+// Only the newest state is kept whole. Every older state is stored as
+// the difference to the one after it: the two are XORed and the result
+// is run-length encoded, so a frame usually costs a few dozen bytes.
+// Rewinding applies the newest difference to get the state before,
+// and when the byte budget runs out the oldest difference is dropped.
+class rewindBuffer
+{
+public:
+	explicit rewindBuffer(size_t bytes = 4 << 20, unsigned maxFrames = 60 * 60 * 5);
+
+	void clear();
+
+	// Records a frame
+	void push(const chip8State& s);
+
+	// Steps back one frame, false when there is nothing older
+	bool pop(chip8State& s);
+
+	// Frames that can still be rewound
+	unsigned frames() const { return count; }
+	size_t bytesUsed() const;
+
+private:
+	struct record
+	{
+		size_t offset, size;
+	};
+
+	std::vector<unsigned char> data;	//Ring of encoded differences
+	std::vector<record> records;		//Ring of where they are, oldest at first
+	unsigned first, count;
+
+	chip8State current;
+	bool hasCurrent;
+
+	std::vector<unsigned char> scratch;
+
+	size_t reserve(size_t size);
+	void dropOldest();
+};
+
+// XOR + run-length codec used by rewindBuffer, out must hold
+// 2 * size + 16 bytes. Returns the encoded size, 0 if a == b.
+size_t encodeDelta(const unsigned char* a, const unsigned char* b, size_t size, unsigned char* out);
+
+// XORs an encoded difference back into state, which turns
+// either of the two encoded states into the other
+void applyDelta(const unsigned char* delta, size_t deltaSize, unsigned char* state);
+#endif
@@ -0,0 +1,203 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+
+#include "chip8-runner.h"
+
+chip8Runner::chip8Runner(chip8& machine, unsigned instructionsPerSecond, unsigned sampleRate)
+	: m(machine), scheduler(machine, instructionsPerSecond), audio(sampleRate), events(*this)
+{
+	scheduler.setAudio(&audio);
+}
+
+chip8Runner::~chip8Runner()
+{
+	stop();
+}
+
+void chip8Runner::setMovie(chip8Movie* mv, bool replay)
+{
+	movie = mv;
+	scheduler.setMovie(movie, replay);
+	replaying = movie && replay;
+}
+
+void chip8Runner::start()
+{
+	if (thread.joinable()) { return; }
+
+	m.setEvents(&events);
+	quit = false;
+	publish();
+	thread = std::thread(&chip8Runner::loop, this);
+}
+
+void chip8Runner::stop()
+{
+	if (!thread.joinable()) { return; }
+
+	quit = true;
+	thread.join();
+	m.setEvents(nullptr);
+}
+
+bool chip8Runner::send(command c, unsigned char arg)
+{
+	return commands.push({ c, arg });
+}
+
+void chip8Runner::runnerEvents::message(const char* text)
+{
+	// Dropped if the frontend doesn't keep up
+	chip8Message msg;
+	std::strncpy(msg.text, text, sizeof msg.text - 1);
+	msg.text[sizeof msg.text - 1] = '\0';
+	owner.messages.push(msg);
+}
+
+void chip8Runner::loop()
+{
+	typedef chip8Scheduler::clock clock;
+	const auto framePeriod = std::chrono::microseconds(1000000 / chip8Scheduler::timerHz);
+	auto nextFrame = clock::now() + framePeriod;
+
+	scheduler.reset();
+	while (!quit.load(std::memory_order_acquire))
+	{
+		cmd c;
+		while (commands.pop(c))
+			apply(c);
+
+		// Rewinding moves at frame rate, otherwise the scheduler
+		// paces the machine, or one emulated frame per pass in turbo
+		if (!rewinding)
+		{
+			const bool ok = turbo ? scheduler.advance(std::max(1u, scheduler.speed() / chip8Scheduler::timerHz))
+				: scheduler.update();
+			//If it returns false we need to stop the emulation
+			if (!ok) { m.stopEmulation(); }
+		}
+
+		const auto now = clock::now();
+		if (now >= nextFrame)
+		{
+			if (rewinding)
+			{
+				// Step back one frame per frame, and play on from there
+				chip8State state;
+				if (history.pop(state))
+				{
+					m.loadState(state);
+					m.isRunning = !m.waitForKey;
+				}
+			}
+			else if (m.isRunning)
+			{
+				history.push(m);
+			}
+			publish();
+
+			if (replaying && movie->finished())
+			{
+				events.message("Replay finished");
+				replaying = false;
+			}
+
+			// Don't try to make up for frames missed during a stall
+			nextFrame = std::max(nextFrame + framePeriod, now);
+		}
+
+		// Turbo keeps the core busy, otherwise the scheduler
+		// catches up on whatever the sleep overshot
+		if (!turbo || rewinding || !m.isRunning)
+			std::this_thread::sleep_until(std::min(nextFrame, now + std::chrono::milliseconds(1)));
+	}
+}
+
+void chip8Runner::apply(const cmd& c)
+{
+	switch (c.c)
+	{
+	case CMD_KEY_PRESS:
+		if (movie) { scheduler.pressKey(c.arg & 0xF); }
+		else { m.keyPress(c.arg & 0xF); }
+		break;
+	case CMD_KEY_RELEASE:
+		if (movie) { scheduler.releaseKey(c.arg & 0xF); }
+		else { m.keyRelease(c.arg & 0xF); }
+		break;
+	case CMD_PAUSE:
+		m.isRunning = !m.isRunning;
+		break;
+	case CMD_STEP:
+		if (movie) { break; }
+		m.isRunning = false;
+		m.emulateCycle(1, true);
+		break;
+	case CMD_TRACE:
+		m.tracing = c.arg != 0;
+		break;
+	case CMD_BACKEND:
+		m.backend = cpuBackend(c.arg);
+		break;
+	case CMD_TURBO:
+		turbo = c.arg != 0;
+		scheduler.reset();
+		break;
+	case CMD_REWIND:
+		if (movie) { break; }
+		rewinding = c.arg != 0;
+		scheduler.reset();
+		break;
+	case CMD_PROFILE:
+		if (c.arg) { m.setProfiling(true); }
+		else if (m.profiling())
+		{
+			m.setProfiling(false);
+			writeProfile();
+		}
+		// Writing files stalls the thread
+		scheduler.reset();
+		break;
+	}
+}
+
+void chip8Runner::writeProfile()
+{
+	std::ofstream report(profilePath + ".txt"), folded(profilePath + ".folded");
+	if (!report || !folded)
+	{
+		events.message("Can't write the profile");
+		return;
+	}
+	m.getProfile()->writeReport(report, m);
+	m.getProfile()->writeCollapsed(folded);
+	events.message("Profile written");
+}
+
+// Copies everything the frontend looks at into the back slot and
+// hands it over, the machine itself is never shared
+void chip8Runner::publish()
+{
+	chip8Frame& f = frames.back();
+
+	if (m.drawFlag)
+	{
+		drawCount++;
+		m.drawFlag = false;
+	}
+
+	m.saveState(f.state);
+	f.running = m.isRunning;
+	f.sound = sound;
+	f.drawCount = drawCount;
+
+	const traceBuffer& trace = m.getTrace();
+	f.traceAvailable = std::min(trace.available(), chip8Frame::traceLines);
+	f.traceCount = trace.count();
+	for (unsigned i = 0; i < f.traceAvailable; i++)
+		f.trace[i] = trace.get(i);
+
+	frames.publish();
+}
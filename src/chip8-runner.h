@@ -0,0 +1,140 @@
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#ifndef RUNNER_H
+#define RUNNER_H
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include "chip8-audio.h"
+#include "chip8-cpu.h"
+#include "chip8-movie.h"
+#include "chip8-rewind.h"
+#include "chip8-scheduler.h"
+#include "chip8-sync.h"
+
+// What the frontend gets to see of the machine, 60 times a second
+struct chip8Frame
+{
+	chip8State state;
+	bool running;		//chip8::isRunning
+	bool sound;			//The buzzer is on
+	unsigned drawCount;	//Changes whenever something was drawn
+
+	//The newest executed instructions, newest first
+	static const unsigned traceLines = 16;
+	traceEntry trace[traceLines];
+	unsigned traceAvailable;
+	unsigned traceCount;	//traceBuffer::count(), changes when anything ran
+};
+
+// A diagnostic line from the core, see chip8Events::message
+struct chip8Message
+{
+	char text[64];
+};
+
+// Runs a machine on its own thread so rendering and emulation
+// can't stall each other.
+//
+// The frontend only talks to the runner: input and controls go in
+// through a lock-free queue and are applied between instruction batches,
+// finished frames come out through a triple buffer and messages through
+// another queue. Once start()ed the machine must not be touched directly.
+class chip8Runner
+{
+public:
+	enum command : unsigned char
+	{
+		CMD_KEY_PRESS,		//arg: key
+		CMD_KEY_RELEASE,	//arg: key
+		CMD_PAUSE,			//Toggles chip8::isRunning
+		CMD_STEP,			//Pauses and runs one instruction
+		CMD_TRACE,			//arg: tracing on or off
+		CMD_BACKEND,		//arg: cpuBackend
+		CMD_TURBO,			//arg: run as fast as possible, timers included
+		CMD_REWIND,			//arg: step back one frame per frame
+		CMD_PROFILE			//arg: start profiling, or stop and write it out (see profilePath)
+	};
+
+	chip8Runner(chip8& machine, unsigned instructionsPerSecond, unsigned sampleRate = 44100);
+	~chip8Runner();
+
+	chip8Runner(const chip8Runner&) = delete;
+	chip8Runner& operator=(const chip8Runner&) = delete;
+
+	// CMD_PROFILE writes the report to profilePath + ".txt" and the
+	// collapsed stacks to profilePath + ".folded". Set before start().
+	std::string profilePath = "chip8-profile";
+
+	// Records the input into a movie, or plays one, from the first
+	// frame on. Stepping and rewinding are off meanwhile, they would
+	// desynchronize it. Call before start(), the machine must be in
+	// the state the movie starts from.
+	void setMovie(chip8Movie* movie, bool replay);
+
+	void start();
+	void stop();
+
+	// Frontend side, false if the queue is full and the command was dropped
+	bool send(command c, unsigned char arg = 0);
+
+	// Frontend side, takes the newest published frame.
+	// False if there was none since the last call.
+	bool update() { return frames.update(); }
+	const chip8Frame& frame() const { return frames.front(); }
+
+	// Frontend side, next queued message
+	bool popMessage(chip8Message& msg) { return messages.pop(msg); }
+
+	// Audio device side, the next n mono samples of the buzzer,
+	// silence where the emulation didn't produce any (see chip8Audio)
+	size_t readAudio(int16_t* out, size_t n) { return audio.read(out, n); }
+	unsigned audioRate() const { return audio.rate(); }
+
+private:
+	struct cmd
+	{
+		command c;
+		unsigned char arg;
+	};
+
+	// Collects what the machine reports on the emulation thread
+	class runnerEvents : public chip8Events
+	{
+	public:
+		explicit runnerEvents(chip8Runner& r) : owner(r) {}
+		void sound(bool on) override { owner.sound = on; }
+		void message(const char* text) override;
+	private:
+		chip8Runner& owner;
+	};
+
+	chip8& m;
+	chip8Scheduler scheduler;
+	chip8Audio audio;
+	rewindBuffer history;	//One state per published frame while the game runs
+	runnerEvents events;
+
+	std::thread thread;
+	std::atomic<bool> quit{ false };
+
+	spscQueue<cmd, 256> commands;
+	spscQueue<chip8Message, 64> messages;
+	tripleBuffer<chip8Frame> frames;
+
+	//Only used on the emulation thread
+	bool sound = false, turbo = false, rewinding = false;
+	chip8Movie* movie = nullptr;
+	bool replaying = false;	//Until the movie ends
+	unsigned drawCount = 0;
+
+	void loop();
+	void apply(const cmd& c);
+	void publish();
+	void writeProfile();
+};
+#endif
@@ -0,0 +1,106 @@
+#include <algorithm>
+
+#include "chip8-audio.h"
+#include "chip8-cpu.h"
+#include "chip8-movie.h"
+#include "chip8-scheduler.h"
+
+chip8Scheduler::chip8Scheduler(chip8& machine, unsigned instructionsPerSecond)
+	: m(machine), ips(std::max(1u, instructionsPerSecond))
+{
+	reset();
+}
+
+void chip8Scheduler::setSpeed(unsigned instructionsPerSecond)
+{
+	ips = std::max(1u, instructionsPerSecond);
+	phase = std::min(phase, ips - 1);
+}
+
+void chip8Scheduler::reset()
+{
+	last = clock::now();
+	owed = 0;
+	phase = 0;
+}
+
+bool chip8Scheduler::update()
+{
+	const auto now = clock::now();
+	const auto passed = std::min(now - last, maxCatchUp);
+	last = now;
+
+	// Paused by the frontend or stopped, but not waiting
+	// for a key, the timers keep running during FX0A
+	if (!m.isRunning && !m.waitForKey) { return true; }
+
+	owed += uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(passed).count())
+		* ips * timeScale;
+
+	const uint64_t due = owed / 1000000;
+	owed -= due * 1000000;
+	return advance(due);
+}
+
+bool chip8Scheduler::advance(uint64_t instructions)
+{
+	if (!m.isRunning && !m.waitForKey) { return true; }
+
+	// With a movie, frames only run as a whole, how far spin loops
+	// are skipped depends on where a batch ends
+	instructions += held;
+	held = 0;
+
+	while (instructions)
+	{
+		// Run up to the next timer tick, in batches emulateCycle accepts.
+		// Every instruction moves phase forward by timerHz.
+		const uint64_t untilTick = (ips - phase + timerHz - 1) / timerHz;
+		if (movie && instructions < untilTick)
+		{
+			held = instructions;
+			break;
+		}
+		if (movie && frameStart)
+		{
+			startFrame();
+			frameStart = false;
+		}
+
+		const unsigned n = unsigned(std::min<uint64_t>({ instructions, untilTick, 0x7FFF }));
+
+		// Emulated time passes even if the machine halts on FX0A
+		// partway through, so the batch counts in full
+		if (!m.emulateCycle(short(n))) { return false; }
+		instructions -= n;
+		executed += n;
+
+		for (phase += n * timerHz; phase >= ips; phase -= ips)
+		{
+			// The tick that just ended sounded if the timer was still running
+			if (audio) { audio->renderTick(m); }
+			m.tickTimers();
+			frameStart = true;
+		}
+	}
+	return true;
+}
+
+void chip8Scheduler::setMovie(chip8Movie* mv, bool play)
+{
+	movie = mv;
+	replay = play;
+	keypad = 0;
+	held = 0;
+	frameStart = true;
+	if (movie && replay) { movie->restart(); }
+	else if (movie) { movie->clear(); }
+}
+
+// Applies the keys of the frame that starts now
+void chip8Scheduler::startFrame()
+{
+	const uint16_t keys = replay ? movie->next() : keypad;
+	if (!replay) { movie->record(keys); }
+	m.setKeys(keys);
+}
@@ -0,0 +1,87 @@
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <chrono>
+#include <cstdint>
+
+class chip8;
+class chip8Audio;
+class chip8Movie;
+
+// Paces a machine against a high resolution clock.
+//
+// The machine runs a fixed number of instructions per second of
+// emulated time and its timers tick every 1/60s of emulated time,
+// no matter how often update() is called. After a host stall the
+// missed instructions are run in batches on the next update(), up to
+// maxCatchUp, anything older than that is skipped.
+class chip8Scheduler
+{
+public:
+	typedef std::chrono::steady_clock clock;
+
+	static const unsigned timerHz = 60;
+
+	explicit chip8Scheduler(chip8& machine, unsigned instructionsPerSecond = 700);
+
+	// Instructions per second of emulated time
+	void setSpeed(unsigned instructionsPerSecond);
+	unsigned speed() const { return ips; }
+
+	// Emulated seconds per host second, e.g. 8 to fast forward
+	void setTimeScale(unsigned scale) { timeScale = scale ? scale : 1; }
+
+	// Longest host stall that is caught up afterwards
+	clock::duration maxCatchUp = std::chrono::milliseconds(250);
+
+	// Runs everything that became due since the last call,
+	// returns false when the emulation must stop
+	bool update();
+
+	// Runs a number of instructions of emulated time right away,
+	// whatever the clock says, e.g. to run unthrottled
+	bool advance(uint64_t instructions);
+
+	// Forget the time that passed, e.g. after the frontend
+	// paused, rewound or loaded a state
+	void reset();
+
+	// Emulated time so far, in instructions
+	uint64_t elapsed() const { return executed; }
+
+	// Renders the sound of every timer tick into audio, nullptr for none
+	void setAudio(chip8Audio* a) { audio = a; }
+
+	// Records the keypad into a movie, or plays it from one, nullptr
+	// for live input. Either way the keys only change when a frame
+	// starts and a frame only runs once all of it is due, so the same
+	// frames run the same way: while recording, pressKey() and
+	// releaseKey() take effect at the start of the next frame.
+	void setMovie(chip8Movie* movie, bool replay);
+	bool hasMovie() const { return movie != nullptr; }
+	void pressKey(unsigned char k) { keypad |= 1 << k; }
+	void releaseKey(unsigned char k) { keypad &= ~(1 << k); }
+
+private:
+	chip8& m;
+	unsigned ips;
+	unsigned timeScale = 1;
+	clock::time_point last;
+	uint64_t owed;		//Instructions due, in millionths so no rounding is lost
+	unsigned phase;		//Progress to the next timer tick, it is due at ips
+	uint64_t executed = 0;
+	chip8Audio* audio = nullptr;
+
+	chip8Movie* movie = nullptr;
+	bool replay = false;
+	bool frameStart = true;	//The next instruction is the first of a frame
+	uint16_t keypad = 0;	//Keys for the next frame while recording
+	uint64_t held = 0;		//Instructions due to a frame that can't run whole yet
+
+	void startFrame();
+};
+#endif
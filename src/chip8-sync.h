@@ -0,0 +1,114 @@
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#ifndef SYNC_H
+#define SYNC_H
+
+#include <atomic>
+#include <cstddef>
+
+// Lock-free hand-offs between exactly two threads, used to
+// run the emulation apart from the frontend (see chip8Runner).
+
+// Bounded single producer, single consumer FIFO.
+// Each side only writes its own index, so push and pop
+// never wait on each other.
+template<typename T, size_t capacity>
+class spscQueue
+{
+	static_assert(capacity && !(capacity & (capacity - 1)), "capacity must be a power of two");
+
+public:
+	// Producer only, false when the queue is full
+	bool push(const T& v)
+	{
+		const size_t t = tail.load(std::memory_order_relaxed);
+		if (t - head.load(std::memory_order_acquire) == capacity) { return false; }
+		items[t & (capacity - 1)] = v;
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer only, false when the queue is empty
+	bool pop(T& v)
+	{
+		const size_t h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire)) { return false; }
+		v = items[h & (capacity - 1)];
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Producer only, pushes as many of n values as fit and returns how many
+	size_t push(const T* v, size_t n)
+	{
+		const size_t t = tail.load(std::memory_order_relaxed);
+		const size_t room = capacity - (t - head.load(std::memory_order_acquire));
+		if (n > room) { n = room; }
+		for (size_t i = 0; i < n; i++)
+			items[(t + i) & (capacity - 1)] = v[i];
+		tail.store(t + n, std::memory_order_release);
+		return n;
+	}
+
+	// Consumer only, pops up to n values and returns how many
+	size_t pop(T* v, size_t n)
+	{
+		const size_t h = head.load(std::memory_order_relaxed);
+		const size_t available = tail.load(std::memory_order_acquire) - h;
+		if (n > available) { n = available; }
+		for (size_t i = 0; i < n; i++)
+			v[i] = items[(h + i) & (capacity - 1)];
+		head.store(h + n, std::memory_order_release);
+		return n;
+	}
+
+	// Either side, a snapshot that may be stale by the time it is used
+	size_t size() const
+	{
+		const size_t h = head.load(std::memory_order_acquire);
+		return tail.load(std::memory_order_acquire) - h;
+	}
+
+private:
+	T items[capacity];
+	alignas(64) std::atomic<size_t> head{ 0 };	//Next to pop, written by the consumer
+	alignas(64) std::atomic<size_t> tail{ 0 };	//Next to push, written by the producer
+};
+
+// Latest-value mailbox for one writer and one reader.
+//
+// The writer fills its own back slot and swaps it with the middle one,
+// the reader swaps the middle one for its front slot when it is newer.
+// Neither side ever waits, the reader always sees a whole value
+// and values it was too slow to see are skipped.
+template<typename T>
+class tripleBuffer
+{
+public:
+	// Writer side: fill back(), then publish() it
+	T& back() { return slots[backIndex]; }
+	void publish()
+	{
+		backIndex = middle.exchange(backIndex | fresh, std::memory_order_acq_rel) & indexMask;
+	}
+
+	// Reader side: true if a newer value than front() was taken
+	bool update()
+	{
+		if (!(middle.load(std::memory_order_relaxed) & fresh)) { return false; }
+		frontIndex = middle.exchange(frontIndex, std::memory_order_acq_rel) & indexMask;
+		return true;
+	}
+	const T& front() const { return slots[frontIndex]; }
+
+private:
+	static const unsigned fresh = 4, indexMask = 3;
+
+	T slots[3] = {};
+	unsigned backIndex = 0;
+	alignas(64) std::atomic<unsigned> middle{ 1 };	//Index of the shared slot, | fresh once published
+	alignas(64) unsigned frontIndex = 2;
+};
+#endif
@@ -0,0 +1,121 @@
+#include <cstdio>
+
+#include "chip8-memory.h"
+#include "chip8-trace.h"
+
+int formatTrace(const traceEntry& e, char* buf, size_t len)
+{
+	const unsigned short opcode = e.opcode;
+	const unsigned
+		X = (opcode & 0x0F00) >> 8,
+		Y = (opcode & 0x00F0) >> 4,
+		NN = opcode & 0x00FF,
+		NNN = opcode & 0x0FFF;
+
+	// Skips are the only instructions that advance PC by 4 (6 over F000 NNNN)
+	const bool skipped = ((e.pc + 2) & mem::pcMask) != e.next;
+
+	auto n = snprintf(buf, len, "(%04X): ", opcode);
+	if (n < 0 || size_t(n) >= len) { return n; }
+	buf += n;
+	len -= n;
+
+	switch (opcode & 0xF000)
+	{
+	case 0x0000:
+		if (opcode == 0x00E0)
+			return n + snprintf(buf, len, "Clear screen");
+		if (opcode == 0x00EE)
+			return n + snprintf(buf, len, "RET from subroutine before %03X, sp:%d", e.next, e.sp);
+		if ((opcode & 0xFFF0) == 0x00C0)
+			return n + snprintf(buf, len, "Scroll down %d rows", opcode & 0x000F);
+		if ((opcode & 0xFFF0) == 0x00D0)
+			return n + snprintf(buf, len, "Scroll up %d rows", opcode & 0x000F);
+		if (opcode == 0x00FB)
+			return n + snprintf(buf, len, "Scroll right 4 pixels");
+		if (opcode == 0x00FC)
+			return n + snprintf(buf, len, "Scroll left 4 pixels");
+		if (opcode == 0x00FD)
+			return n + snprintf(buf, len, "Exit");
+		if (opcode == 0x00FE)
+			return n + snprintf(buf, len, "Lo-res 64x32");
+		if (opcode == 0x00FF)
+			return n + snprintf(buf, len, "Hi-res 128x64");
+		break;
+	case 0x1000:
+		return n + snprintf(buf, len, "Jump to %03X", NNN);
+	case 0x2000:
+		return n + snprintf(buf, len, "CALL subroutine %03X, sp:%d", NNN, e.sp - 1);
+	case 0x3000:
+		return n + snprintf(buf, len, skipped ? "V%X == %02X, so skip" : "V%X != %02X, so don't skip", X, NN);
+	case 0x4000:
+		return n + snprintf(buf, len, skipped ? "V%X != %02X, so skip" : "V%X == %02X, so don't skip", X, NN);
+	case 0x5000:
+		if ((opcode & 0x000F) == 0x2)
+			return n + snprintf(buf, len, "Store V%X to V%X starting at I=%04X", X, Y, e.I);
+		if ((opcode & 0x000F) == 0x3)
+			return n + snprintf(buf, len, "Fill V%X to V%X with values from I=%04X", X, Y, e.I);
+		return n + snprintf(buf, len, skipped ? "V%X == V%X, so skip" : "V%X != V%X, so don't skip", X, Y);
+	case 0x6000:
+		return n + snprintf(buf, len, "V%X = %02X", X, NN);
+	case 0x7000:
+		return n + snprintf(buf, len, "V%X += %02X", X, NN);
+	case 0x8000:
+		switch (opcode & 0x000F)
+		{
+		case 0x0: return n + snprintf(buf, len, "V%X = V%X", X, Y);
+		case 0x1: return n + snprintf(buf, len, "V%X |= V%X", X, Y);
+		case 0x2: return n + snprintf(buf, len, "V%X &= V%X", X, Y);
+		case 0x3: return n + snprintf(buf, len, "V%X ^= V%X", X, Y);
+		case 0x4: return n + snprintf(buf, len, "V%X += V%X, carry=%d", X, Y, e.vf);
+		case 0x5:
+		case 0x7: return n + snprintf(buf, len, "V%X -= V%X, carry=%d", X, Y, e.vf);
+		case 0x6: return n + snprintf(buf, len, "V%X >>= 1, VF=%X", X, e.vf);
+		case 0xE: return n + snprintf(buf, len, "V%X <<= 1, VF=%X", X, e.vf);
+		}
+		break;
+	case 0x9000:
+		return n + snprintf(buf, len, skipped ? "V%X != V%X, so skip" : "V%X == V%X, so don't skip", X, Y);
+	case 0xA000:
+		return n + snprintf(buf, len, "I = %03X", e.I);
+	case 0xB000:
+		return n + snprintf(buf, len, "Jump to %03X + V0 = %04X", NNN, e.next);
+	case 0xC000:
+		return n + snprintf(buf, len, "Randomizing V%X", X);
+	case 0xD000:
+		return n + snprintf(buf, len, "Drawing in X:%d, Y:%d, height:%d", e.vx & 63, e.vy & 31, opcode & 0x000F);
+	case 0xE000:
+		if (NN == 0x9E)
+			return n + snprintf(buf, len, skipped ? "Key in V%X is pressed, so skip"
+			                                      : "Key in V%X is not pressed, so don't skip", X);
+		if (NN == 0xA1)
+			return n + snprintf(buf, len, skipped ? "Key in V%X is not pressed, so skip"
+			                                      : "Key in V%X is pressed, so don't skip", X);
+		break;
+	case 0xF000:
+		if (opcode == 0xF000)
+			return n + snprintf(buf, len, "I = %04X", e.I);
+		if (opcode == 0xF002)
+			return n + snprintf(buf, len, "Audio pattern from I=%04X", e.I);
+		switch (NN)
+		{
+		case 0x01: return n + snprintf(buf, len, "Select planes %X", X);
+		case 0x07: return n + snprintf(buf, len, "V%X = delay_timer = %d", X, e.vxOut);
+		case 0x0A: return n + snprintf(buf, len, "Waiting for key to be stored in V%X", X);
+		case 0x15: return n + snprintf(buf, len, "delay_timer = V%X = %02X", X, e.vx);
+		case 0x18: return n + snprintf(buf, len, "sound_timer = V%X = %02X", X, e.vx);
+		case 0x1E: return n + snprintf(buf, len, "I += V%X, carry=%d", X, e.vf);
+		case 0x29: return n + snprintf(buf, len, "I = %03X (loc of sprite for char %X)", e.I, X);
+		case 0x30: return n + snprintf(buf, len, "I = %03X (loc of big sprite for char %X)", e.I, X);
+		case 0x33: return n + snprintf(buf, len, "mem[I] = BCD(V%X), VX is %X, so changing memory to %X, %X, %X",
+		                               X, e.vx, e.vx / 100, e.vx / 10 % 10, e.vx % 10);
+		case 0x3A: return n + snprintf(buf, len, "pitch = V%X = %02X", X, e.vx);
+		case 0x55: return n + snprintf(buf, len, "Store V0 to V%X starting at I=%03X", X, e.I);
+		case 0x65: return n + snprintf(buf, len, "Fill V0 to V%X with values from I=%03X", X, e.I);
+		case 0x75: return n + snprintf(buf, len, "Store V0 to V%X in the flags", X);
+		case 0x85: return n + snprintf(buf, len, "Fill V0 to V%X from the flags", X);
+		}
+		break;
+	}
+	return n + snprintf(buf, len, "Unknown opcode");
+}
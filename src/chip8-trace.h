@@ -0,0 +1,63 @@
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstddef>
+
+// Instruction tracing can be compiled out entirely with CHIP8_TRACE=0,
+// otherwise it is still off until chip8::tracing is set at runtime
+#ifndef CHIP8_TRACE
+#define CHIP8_TRACE 1
+#endif
+
+// Raw record of one executed instruction.
+// Nothing is formatted while emulating, formatTrace() turns
+// an entry into text only when someone wants to read it.
+struct traceEntry
+{
+	unsigned short
+		pc,			//Address of the instruction
+		opcode,		//The instruction itself
+		next,		//PC after execution
+		I;			//I after execution
+
+	unsigned char
+		vx,			//VX before execution
+		vy,			//VY before execution
+		vxOut,		//VX after execution
+		vf,			//VF after execution
+		sp;			//Stack pointer after execution
+};
+
+// Fixed-size ring of the most recently executed instructions
+class traceBuffer
+{
+public:
+	static const unsigned size = 64;	//Must be a power of two
+
+	void clear() { head = 0; }
+
+	void push(const traceEntry& e) { entries[head++ & (size - 1)] = e; }
+
+	// Total number of entries pushed since the last clear,
+	// also usable as a cheap "did anything change" stamp
+	unsigned count() const { return head; }
+
+	// Number of entries that can still be read back
+	unsigned available() const { return head < size ? head : size; }
+
+	// 0 is the newest entry, available() - 1 the oldest
+	const traceEntry& get(unsigned back) const { return entries[(head - 1 - back) & (size - 1)]; }
+
+private:
+	traceEntry entries[size];
+	unsigned head = 0;
+};
+
+// Writes the debug line for an entry, e.g. "(6A02): VA = 02"
+// Returns the number of characters written (like snprintf)
+int formatTrace(const traceEntry& e, char* buf, size_t len);
+#endif
@@ -0,0 +1,322 @@
+#include <algorithm>
+#include <cstring>
+#include <istream>
+#include <iterator>
+
+#include "chip8-memory.h"
+#include "chip8-tracefile.h"
+
+static const char magic[4] = { 'C', '8', 'T', 'R' };
+static const unsigned char version = 1;
+
+// Written chunk buffers kept for reuse
+static const size_t maxSpare = 16;
+
+static unsigned char* putVarint(unsigned char* p, uint32_t v)
+{
+	while (v >= 0x80)
+	{
+		*p++ = (unsigned char)(v | 0x80);
+		v >>= 7;
+	}
+	*p++ = (unsigned char)v;
+	return p;
+}
+
+static bool getVarint(const unsigned char*& p, const unsigned char* end, uint32_t& v)
+{
+	v = 0;
+	for (unsigned shift = 0; shift < 35 && p != end; shift += 7)
+	{
+		const unsigned char c = *p++;
+		v |= uint32_t(c & 0x7F) << shift;
+		if (!(c & 0x80)) { return true; }
+	}
+	return false;
+}
+
+static bool getVarint(std::istream& in, uint32_t& v)
+{
+	v = 0;
+	for (unsigned shift = 0; shift < 35; shift += 7)
+	{
+		const int c = in.get();
+		if (c == std::char_traits<char>::eof()) { return false; }
+		v |= uint32_t(c & 0x7F) << shift;
+		if (!(c & 0x80)) { return true; }
+	}
+	return false;
+}
+
+// 16-bit difference, small either way round
+static uint32_t zigzag(unsigned short value, unsigned short predicted)
+{
+	const int d = int16_t(value - predicted);
+	return uint32_t(d) << 1 ^ uint32_t(d >> 31);
+}
+
+static unsigned short unzigzag(uint32_t v, unsigned short predicted)
+{
+	return (unsigned short)(predicted + (v >> 1 ^ (0 - (v & 1))));
+}
+
+// What the entries before say VY and VF will be, VX is only known
+// after it is read
+static unsigned char predictVY(const unsigned char* V, const traceEntry& e, unsigned x, unsigned y)
+{
+	return x == y ? e.vx : V[y];
+}
+
+static unsigned char predictVF(const unsigned char* V, const traceEntry& e, unsigned x, unsigned y)
+{
+	return x == 0xF ? e.vxOut : y == 0xF ? e.vy : V[0xF];
+}
+
+void traceCodec::reset()
+{
+	last = traceEntry();
+	last.next = 0x200;
+	std::memset(V, 0, sizeof V);
+	std::memset(ops, 0, sizeof ops);
+}
+
+void traceCodec::update(const traceEntry& e)
+{
+	const unsigned x = (e.opcode & 0x0F00) >> 8, y = (e.opcode & 0x00F0) >> 4;
+	last = e;
+	ops[e.pc & mem::pcMask] = e.opcode;
+	V[y] = e.vy;
+	V[x] = e.vxOut;
+	V[0xF] = e.vf;
+}
+
+size_t traceCodec::encode(const traceEntry& e, unsigned char* out)
+{
+	const unsigned x = (e.opcode & 0x0F00) >> 8, y = (e.opcode & 0x00F0) >> 4;
+	const unsigned short next = (e.pc + 2) & mem::pcMask;
+
+	unsigned flags = 0;
+	if (e.pc != last.next) { flags |= PC; }
+	if (e.opcode != ops[e.pc & mem::pcMask]) { flags |= OPCODE; }
+	if (e.next != next) { flags |= NEXT; }
+	if (e.I != last.I) { flags |= I; }
+	if (e.vx != V[x]) { flags |= VX; }
+	if (e.vy != predictVY(V, e, x, y)) { flags |= VY; }
+	if (e.vxOut != e.vx) { flags |= VXOUT; }
+	if (e.vf != predictVF(V, e, x, y)) { flags |= VF; }
+	if (e.sp != last.sp) { flags |= SP; }
+
+	unsigned char* p = putVarint(out, flags);
+	if (flags & PC) { p = putVarint(p, zigzag(e.pc, last.next)); }
+	if (flags & OPCODE)
+	{
+		*p++ = (unsigned char)(e.opcode >> 8);
+		*p++ = (unsigned char)e.opcode;
+	}
+	if (flags & NEXT) { p = putVarint(p, zigzag(e.next, next)); }
+	if (flags & I) { p = putVarint(p, zigzag(e.I, last.I)); }
+	if (flags & VX) { *p++ = e.vx; }
+	if (flags & VY) { *p++ = e.vy; }
+	if (flags & VXOUT) { *p++ = e.vxOut; }
+	if (flags & VF) { *p++ = e.vf; }
+	if (flags & SP) { *p++ = e.sp; }
+
+	update(e);
+	return size_t(p - out);
+}
+
+bool traceCodec::decode(const unsigned char*& p, const unsigned char* end, traceEntry& e)
+{
+	uint32_t flags, v;
+	auto byte = [&](unsigned char& b) {
+		if (p == end) { return false; }
+		b = *p++;
+		return true;
+	};
+
+	if (!getVarint(p, end, flags)) { return false; }
+
+	e.pc = last.next;
+	if (flags & PC)
+	{
+		if (!getVarint(p, end, v)) { return false; }
+		e.pc = unzigzag(v, last.next);
+	}
+
+	e.opcode = ops[e.pc & mem::pcMask];
+	if (flags & OPCODE)
+	{
+		unsigned char hi, lo;
+		if (!byte(hi) || !byte(lo)) { return false; }
+		e.opcode = (unsigned short)(hi << 8 | lo);
+	}
+	const unsigned x = (e.opcode & 0x0F00) >> 8, y = (e.opcode & 0x00F0) >> 4;
+
+	e.next = (e.pc + 2) & mem::pcMask;
+	if (flags & NEXT)
+	{
+		if (!getVarint(p, end, v)) { return false; }
+		e.next = unzigzag(v, e.next);
+	}
+
+	e.I = last.I;
+	if (flags & I)
+	{
+		if (!getVarint(p, end, v)) { return false; }
+		e.I = unzigzag(v, last.I);
+	}
+
+	e.vx = V[x];
+	if ((flags & VX) && !byte(e.vx)) { return false; }
+	e.vy = predictVY(V, e, x, y);
+	if ((flags & VY) && !byte(e.vy)) { return false; }
+	e.vxOut = e.vx;
+	if ((flags & VXOUT) && !byte(e.vxOut)) { return false; }
+	e.vf = predictVF(V, e, x, y);
+	if ((flags & VF) && !byte(e.vf)) { return false; }
+	e.sp = last.sp;
+	if ((flags & SP) && !byte(e.sp)) { return false; }
+
+	update(e);
+	return true;
+}
+
+chip8TraceWriter::chip8TraceWriter(const char* path)
+	: out(path, std::ios::binary), ok(bool(out)), written(0)
+{
+	if (!ok)
+	{
+		closing = true;
+		return;
+	}
+	out.write(magic, sizeof magic);
+	out.put(char(version));
+	written = sizeof magic + 1;
+	thread = std::thread(&chip8TraceWriter::run, this);
+}
+
+void chip8TraceWriter::close()
+{
+	{
+		std::lock_guard<std::mutex> l(lock);
+		closing = true;
+	}
+	wake.notify_one();
+	if (thread.joinable()) { thread.join(); }
+	out.close();
+}
+
+void chip8TraceWriter::submit(chunk&& c)
+{
+	{
+		std::lock_guard<std::mutex> l(lock);
+		if (!closing) { pending.push_back(std::move(c)); }
+		else if (spare.size() < maxSpare) { spare.push_back(std::move(c.data)); }
+	}
+	wake.notify_one();
+}
+
+std::vector<unsigned char> chip8TraceWriter::take()
+{
+	std::lock_guard<std::mutex> l(lock);
+	if (spare.empty()) { return std::vector<unsigned char>(); }
+	auto b = std::move(spare.back());
+	spare.pop_back();
+	return b;
+}
+
+void chip8TraceWriter::run()
+{
+	std::vector<chunk> batch;
+	std::unique_lock<std::mutex> l(lock);
+	for (;;)
+	{
+		wake.wait(l, [this] { return closing || !pending.empty(); });
+		if (pending.empty()) { break; }
+
+		batch.assign(std::make_move_iterator(pending.begin()), std::make_move_iterator(pending.end()));
+		pending.clear();
+		l.unlock();
+
+		for (auto& c : batch)
+		{
+			unsigned char head[15];
+			unsigned char* p = putVarint(head, c.stream);
+			p = putVarint(p, c.entries);
+			p = putVarint(p, uint32_t(c.data.size()));
+			out.write(reinterpret_cast<const char*>(head), p - head);
+			out.write(reinterpret_cast<const char*>(c.data.data()), c.data.size());
+			written += uint64_t(p - head) + c.data.size();
+		}
+		if (!out) { ok = false; }
+
+		l.lock();
+		for (auto& c : batch)
+		{
+			if (spare.size() >= maxSpare) { break; }
+			c.data.clear();
+			spare.push_back(std::move(c.data));
+		}
+		batch.clear();
+	}
+	out.flush();
+	if (!out) { ok = false; }
+}
+
+chip8TraceStream::chip8TraceStream(chip8TraceWriter& writer, unsigned id)
+	: writer(writer), stream(id), buf(writer.take())
+{
+	buf.resize(chunkSize);
+}
+
+void chip8TraceStream::flush()
+{
+	if (!count) { return; }
+
+	buf.resize(used);
+	writer.submit(chip8TraceWriter::chunk{ stream, count, std::move(buf) });
+	total += count;
+	count = 0;
+	used = 0;
+
+	buf = writer.take();
+	buf.resize(chunkSize);
+	codec.reset();
+}
+
+bool chip8TraceReader::open(std::istream& in)
+{
+	char head[sizeof magic + 1];
+	this->in = nullptr;
+	if (!in.read(head, sizeof head)) { return false; }
+	if (std::memcmp(head, magic, sizeof magic) || (unsigned char)head[sizeof magic] != version) { return false; }
+	this->in = &in;
+	return true;
+}
+
+bool chip8TraceReader::next(unsigned& stream, std::vector<traceEntry>& entries)
+{
+	uint32_t id, count, size;
+	entries.clear();
+	if (!in || in->peek() == std::char_traits<char>::eof()) { return false; }
+
+	cut = true;
+	if (!getVarint(*in, id) || !getVarint(*in, count) || !getVarint(*in, size)) { return false; }
+
+	// Every entry takes at least a byte
+	if (count > size) { return false; }
+	data.resize(size);
+	if (!in->read(reinterpret_cast<char*>(data.data()), size)) { return false; }
+
+	codec.reset();
+	entries.resize(count);
+	const unsigned char* p = data.data();
+	const unsigned char* end = p + size;
+	for (auto& e : entries)
+	{
+		if (!codec.decode(p, end, e)) { return false; }
+	}
+	stream = id;
+	cut = false;
+	return true;
+}
@@ -0,0 +1,176 @@
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#ifndef TRACEFILE_H
+#define TRACEFILE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <iosfwd>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "chip8-trace.h"
+
+// Complete traces of long runs, written to a file in a compact binary
+// form and turned back into formatTrace lines by chip8-tracedump.
+//
+// Every traced machine encodes into its own chip8TraceStream, which only
+// the thread running the machine touches. Full chunks are handed to the
+// chip8TraceWriter, whose thread appends them to the file, so emulating
+// never waits for the disk. If the disk can't keep up, chunks queue up
+// in memory.
+//
+// File layout:
+//   "C8TR", version (1 byte),
+//   then chunks of: stream, entries, bytes (varints each), encoded entries.
+// Every chunk starts from a fresh traceCodec, so it decodes on its own
+// and a file cut short loses at most its last chunk.
+
+// Encodes entries as the difference to what the ones before predict.
+// An entry is a varint of the flags below, saying which fields are
+// stored, followed by those fields in this order: PC, opcode, next PC,
+// I, VX, VY, VX after, VF and SP. PC, next PC and I are zigzag varint
+// deltas, the opcode is 2 bytes and the rest 1 byte each. Taken jumps,
+// changed registers and the first run of each address are what costs
+// bytes.
+class traceCodec
+{
+public:
+	enum
+	{
+		NEXT	= 0x001,	//PC after isn't the following instruction
+		I		= 0x002,	//I changed
+		VX		= 0x004,	//VX before differs from the last value seen
+		VY		= 0x008,	//VY before differs from the last value seen
+		VXOUT	= 0x010,	//VX changed
+		VF		= 0x020,	//VF after differs from the last value seen
+		SP		= 0x040,	//Stack pointer changed
+		OPCODE	= 0x080,	//Not what ran at this address last time
+		PC		= 0x100		//Not where the last instruction went to
+	};
+
+	// Longest encoded entry
+	static const size_t maxEntry = 18;
+
+	traceCodec() { reset(); }
+	void reset();
+
+	// Writes the entry to out, returns the bytes written
+	size_t encode(const traceEntry& e, unsigned char* out);
+	// Reads one entry and moves p past it, false if it's cut short
+	bool decode(const unsigned char*& p, const unsigned char* end, traceEntry& e);
+
+private:
+	traceEntry last;
+	unsigned char V[16];		//Registers as far as the entries tell
+	unsigned short ops[0x1000];	//Last opcode seen per address
+
+	void update(const traceEntry& e);
+};
+
+class chip8TraceWriter
+{
+public:
+	explicit chip8TraceWriter(const char* path);
+	~chip8TraceWriter() { close(); }
+
+	chip8TraceWriter(const chip8TraceWriter&) = delete;
+	chip8TraceWriter& operator=(const chip8TraceWriter&) = delete;
+
+	// Writes everything submitted and closes the file, later chunks
+	// are dropped. Flush or destroy the streams first.
+	void close();
+
+	// False if the file couldn't be opened or a write failed
+	bool good() const { return ok; }
+	// Bytes written to the file so far
+	uint64_t bytes() const { return written; }
+
+private:
+	friend class chip8TraceStream;
+
+	struct chunk
+	{
+		unsigned stream;
+		uint32_t entries;
+		std::vector<unsigned char> data;
+	};
+
+	std::ofstream out;
+	std::atomic<bool> ok;
+	std::atomic<uint64_t> written;
+
+	std::mutex lock;
+	std::condition_variable wake;
+	std::deque<chunk> pending;		//Submitted, not written yet
+	std::vector<std::vector<unsigned char>> spare;	//Written, to be filled again
+	bool closing = false;
+	std::thread thread;
+
+	void submit(chunk&& c);
+	std::vector<unsigned char> take();
+	void run();
+};
+
+// One machine's share of a trace file, see chip8::setTraceStream.
+// Nothing in it is locked, only one thread may push at a time.
+class chip8TraceStream
+{
+public:
+	static const size_t chunkSize = 64 * 1024;
+
+	chip8TraceStream(chip8TraceWriter& writer, unsigned id);
+	~chip8TraceStream() { flush(); }
+
+	chip8TraceStream(const chip8TraceStream&) = delete;
+	chip8TraceStream& operator=(const chip8TraceStream&) = delete;
+
+	void push(const traceEntry& e)
+	{
+		if (used + traceCodec::maxEntry > chunkSize) { flush(); }
+		used += codec.encode(e, buf.data() + used);
+		count++;
+	}
+
+	// Hands the buffered entries to the writer
+	void flush();
+
+	unsigned id() const { return stream; }
+	uint64_t entries() const { return total + count; }
+
+private:
+	chip8TraceWriter& writer;
+	unsigned stream;
+	traceCodec codec;
+	std::vector<unsigned char> buf;
+	size_t used = 0;
+	uint32_t count = 0;		//Entries in buf
+	uint64_t total = 0;		//Entries flushed
+};
+
+// Reads a trace file back a chunk at a time
+class chip8TraceReader
+{
+public:
+	// False if it isn't a trace file
+	bool open(std::istream& in);
+
+	// Decodes the next chunk, false at the end of the file or if the
+	// chunk is cut short
+	bool next(unsigned& stream, std::vector<traceEntry>& entries);
+	// Whether next() stopped at a chunk that is cut short
+	bool truncated() const { return cut; }
+
+private:
+	std::istream* in = nullptr;
+	bool cut = false;
+	std::vector<unsigned char> data;
+	traceCodec codec;
+};
+#endif
@@ -1,21 +1,38 @@
 #include <SFML/Graphics.hpp>
-#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <memory>
 #include <string>
-#include <iomanip>
+#include <algorithm>
 
 #include "chip8-cpu.h"
 #include "chip8-memory.h"
-#include "sfTextTools.h"
+#include "chip8-movie.h"
+#include "chip8-runner.h"
+#include "chip8-tracefile.h"
+#include "sfAudioStream.h"
+#include "sfDebugOverlay.h"
 
 
 //Resolution multiplier
 #define RES_MULT 12
 //Padding pixels for debug strings
 #define PAD 3
+//Number of executed instructions shown in Debug mode
+#define TRACE_LINES 12
+//Longest debug message or trace line shown, the rest is cut off
+#define DEBUG_COLUMNS 64
+//Default CPU speed in instructions per second, the second argument overrides it
+#define DEFAULT_IPS 700
 
 
 #define FG_COLOR 215, 235, 245
 #define BG_COLOR 102, 50, 110
+//XO-CHIP pixels set only on the second plane, and on both
+#define PLANE2_COLOR 240, 170, 60
+#define BOTH_COLOR 120, 200, 120
 #define DEBUG_COLOR 0, 0, 0
 
 #ifdef _DEBUG
@@ -24,29 +41,72 @@ auto isDebug = true;
 auto isDebug = false;
 #endif
 
-void appendText(sf::Text* text, std::string st);
-void replaceText(sf::Text* text, std::string st);
-
-static void updRegText(std::ostringstream* ss, sf::Text* regText);
+static void updRegText(textLines& regText, const chip8Frame& frame);
+static void updTraceText(textLines& traceText, const chip8Frame& frame);
 
+static void updScreen(const chip8State& state);
 void createScreen();
-void resizeScreen(bool isExtended);
+void resizeScreen(bool isExtended, const chip8State& state);
 
+//The machine runs on its own thread once the runner is started,
+//after that the frontend only sees the frames it publishes
 chip8 myChip8;
-std::vector<sf::RectangleShape> screen(64 * 32);
-sf::Text debugText;
+//The framebuffer lives in a texture with one texel per pixel,
+//drawn scaled up by a single sprite
+sf::Texture screenTexture;
+sf::Sprite screenSprite;
+std::vector<sf::Uint8> screenRGBA;
+unsigned screenW, screenH;
+
+static int usage()
+{
+	std::fprintf(stderr,
+		"usage: chip8-emu rom [instructions per second] [--record movie | --play movie] [--trace file]\n"
+		"  --record <movie>  save the keypad of every frame when the emulator closes\n"
+		"  --play <movie>    replay a recorded movie\n"
+		"  --trace <file>    write every executed instruction to a trace file (see chip8-tracedump)\n");
+	return -1;
+}
 
 int main(int argc, char* argv[])
 {
-	std::string game_path;
+	std::string game_path, record_path, play_path, trace_path;
+	unsigned speed = DEFAULT_IPS;
 	if (argc > 1)
 	{
 		game_path = argv[1];
+		for (int i = 2; i < argc; i++)
+		{
+			const std::string arg = argv[i];
+			if (arg == "--record" && i + 1 < argc) { record_path = argv[++i]; }
+			else if (arg == "--play" && i + 1 < argc) { play_path = argv[++i]; }
+			else if (arg == "--trace" && i + 1 < argc) { trace_path = argv[++i]; }
+			else
+			{
+				char* end;
+				const long ips = std::strtol(arg.c_str(), &end, 10);
+				if (end == arg.c_str() || *end || ips <= 0) { return usage(); }
+				speed = unsigned(ips);
+			}
+		}
 	}
 	else
 	{
 		//No path given
-		return -1;
+		return usage();
+	}
+
+	//A replay brings its own speed and seed
+	chip8Movie movie;
+	if (!play_path.empty())
+	{
+		std::ifstream in(play_path, std::ios::binary);
+		if (!movie.load(in))
+		{
+			std::fprintf(stderr, "Can't read the movie %s\n", play_path.c_str());
+			return -1;
+		}
+		speed = movie.ips;
 	}
 
 	//Setup window creation
@@ -68,38 +128,32 @@ int main(int argc, char* argv[])
 		return -1;
 	}
 
-	srand(static_cast<unsigned int>(time(nullptr))); // use current time as seed for random generator
-
-	sf::Color fg_color(FG_COLOR);
-	sf::Color bg_color(BG_COLOR);
-
 	// Set up debugging stuff
 	// -----------------------------------------------------------
-	sf::Text regText;
-	sf::Text fpsText;
-
-	sf::Clock Clock;
-	unsigned short Framerate;
-
-	debugText.setFont(mc_font);
-	debugText.setCharacterSize(14);
-	debugText.setPosition(0 + PAD, 12 * 3 + 6 + PAD);
-	debugText.setColor(sf::Color(DEBUG_COLOR));
-	debugText.setStyle(sf::Text::Style::Bold);
-
-	regText.setFont(mc_font);
-	regText.setCharacterSize(8);
+	//The glyphs are looked up once here, the texts below only
+	//lay out the lines that changed since the last frame
+	const glyphAtlas smallGlyphs(mc_font, 8);
+	const glyphAtlas fpsGlyphs(mc_font, 12);
+	const glyphAtlas debugGlyphs(mc_font, 14, true);
+
+	//Messages scroll up once the space above the trace is used
+	const float debugTop = 12 * 3 + 6 + PAD;
+	const auto debugLines = unsigned(std::max(1.f, (32 * RES_MULT - 35 - debugTop) / debugGlyphs.lineSpacing()));
+	textLines debugText(debugGlyphs, debugLines, DEBUG_COLUMNS, sf::Color(DEBUG_COLOR));
+	debugText.setPosition(0 + PAD, debugTop);
+
+	textLines regText(smallGlyphs, 16, 5, sf::Color::Red);
 	regText.setPosition(64*RES_MULT - 6 * 5 - PAD, 40 + PAD);
-	regText.setColor(sf::Color::Red);
 
-	fpsText.setFont(mc_font);
-	fpsText.setCharacterSize(12);
+	textLines traceText(smallGlyphs, TRACE_LINES, DEBUG_COLUMNS, sf::Color(DEBUG_COLOR));
+	traceText.setPosition(0 + PAD, 32 * RES_MULT - (TRACE_LINES + 1) * smallGlyphs.lineSpacing() - PAD);
+
+	textLines fpsText(fpsGlyphs, 1, 5, sf::Color::Cyan);
 	fpsText.setPosition(64*RES_MULT - 6 * 3 - PAD, 8 + PAD);
-	fpsText.setColor(sf::Color(sf::Color::Cyan));
 
-	//Create the stream/string for registry display in Debug mode
-	std::ostringstream regSStream;
-	regSStream << std::hex << std::setfill('0') << std::uppercase;
+	sf::Clock Clock;
+	unsigned short Framerate;
+	char fpsLine[8];
 
 	//Signifies waiting for input
 	sf::RectangleShape input_rec(sf::Vector2f(32, 7));
@@ -113,19 +167,71 @@ int main(int argc, char* argv[])
 
 	// -----------------------------------------------------------
 
-	appendText(&debugText, "Initializing chip8");
+	auto isBeeping = false;
+
+	debugText.push("Initializing chip8");
 	if (myChip8.initialize() )
 	{
 		return -1;
 	}
+	myChip8.tracing = isDebug;
 
 	auto load_result = myChip8.loadGame(game_path.c_str());
-	appendText(&debugText, "Loaded  " + std::to_string(load_result) + "  bytes to memory");
+	debugText.push(("Loaded  " + std::to_string(load_result) + "  bytes to memory").c_str());
+
+	const auto romSum = chip8Movie::checksum(myChip8.memory + 0x200, load_result);
+	if (!play_path.empty())
+	{
+		if (movie.romSum != romSum || movie.mode != myChip8.mode)
+		{
+			std::fprintf(stderr, "%s was recorded with another ROM\n", play_path.c_str());
+			return -1;
+		}
+	}
+	else
+	{
+		//CXNN numbers differ from run to run, unless a movie replays them
+		movie.seed = uint64_t(std::time(nullptr));
+		movie.ips = speed;
+		movie.mode = myChip8.mode;
+		movie.romSum = romSum;
+	}
+	myChip8.seed(movie.seed);
+
+	//Every instruction goes to the trace file, written by its own thread
+	std::unique_ptr<chip8TraceWriter> traceWriter;
+	std::unique_ptr<chip8TraceStream> traceStream;
+	if (!trace_path.empty())
+	{
+		traceWriter.reset(new chip8TraceWriter(trace_path.c_str()));
+		if (!traceWriter->good())
+		{
+			std::fprintf(stderr, "Can't write the trace %s\n", trace_path.c_str());
+			return -1;
+		}
+		traceStream.reset(new chip8TraceStream(*traceWriter, 0));
+		myChip8.setTraceStream(traceStream.get());
+	}
 
 	createScreen();
 
 	//myChip8.isRunning = false;
 
+	//Input goes to the emulation thread as commands
+	//Static, its three frames hold a whole machine each and are too
+	//big for the stack. new would ignore its alignment.
+	static chip8Runner runner(myChip8, speed);
+	if (!play_path.empty()) { runner.setMovie(&movie, true); }
+	else if (!record_path.empty()) { runner.setMovie(&movie, false); }
+	auto backend = myChip8.backend;
+	auto isProfiling = false;
+	unsigned drawCount = 0;
+	runner.start();
+
+	//The buzzer is synthesized by the emulation thread, the stream only plays it
+	sfAudioStream audio(runner);
+	audio.play();
+
 	//Main Loop
 	while (window.isOpen())
 	{
@@ -144,24 +250,40 @@ int main(int argc, char* argv[])
 			switch (event.key.code)
 			{
 			case sf::Keyboard::F1:
-				myChip8.isRunning = !myChip8.isRunning;
+				runner.send(chip8Runner::CMD_PAUSE);
 				break;
 			case sf::Keyboard::F2:
-				myChip8.isRunning = false;
-				myChip8.emulateCycle(1, true);
+				runner.send(chip8Runner::CMD_STEP);
 				break;
 			case sf::Keyboard::F3:
 				isDebug = !isDebug;
+				runner.send(chip8Runner::CMD_TRACE, isDebug);
+				break;
+			case sf::Keyboard::F4:
+			{
+				static const char* const names[] = { "Backend: switch", "Backend: table", "Backend: jit", "Backend: cached", "Backend: aot" };
+				backend = cpuBackend((backend + 1) % 5);
+				runner.send(chip8Runner::CMD_BACKEND, backend);
+				debugText.push(names[backend]);
+				break;
+			}
+			case sf::Keyboard::F5:
+				isProfiling = !isProfiling;
+				runner.send(chip8Runner::CMD_PROFILE, isProfiling);
+				if (isProfiling) { debugText.push("Profiling"); }
 				break;
 
 			case sf::Keyboard::Tab:
 			{
-				window.setFramerateLimit(0);
+				runner.send(chip8Runner::CMD_TURBO, true);
 				break;
 			}
+			case sf::Keyboard::BackSpace:
+				runner.send(chip8Runner::CMD_REWIND, true);
+				break;
 			default:
 				// Assign keys to Chip8 key codes 
-				#define keypress(x) myChip8.keyPress(x); break;
+				#define keypress(x) runner.send(chip8Runner::CMD_KEY_PRESS, x); break;
 
 				case sf::Keyboard::Num1: keypress(1); 
 				case sf::Keyboard::Num2: keypress(2);
@@ -190,12 +312,15 @@ int main(int argc, char* argv[])
 			{
 			case sf::Keyboard::Tab:
 			{
-				window.setFramerateLimit(60);
+				runner.send(chip8Runner::CMD_TURBO, false);
 				break;
 			}
+			case sf::Keyboard::BackSpace:
+				runner.send(chip8Runner::CMD_REWIND, false);
+				break;
 			default:
 				// Assign keys to Chip8 key codes 
-				#define keyrelease(x) myChip8.keyRelease(x); break;
+				#define keyrelease(x) runner.send(chip8Runner::CMD_KEY_RELEASE, x); break;
 
 				case sf::Keyboard::Num1: keyrelease(1);
 				case sf::Keyboard::Num2: keyrelease(2);
@@ -222,36 +347,37 @@ int main(int argc, char* argv[])
 		}
 	}
 
-	//If emulateCycle returns false we need to stop the emulation
-	if ( myChip8.isRunning && 
-		!myChip8.emulateCycle(6) )
+	//Take the newest frame the emulation thread finished,
+	//drawing doesn't wait for it and it doesn't wait for drawing
+	runner.update();
+	const auto& frame = runner.frame();
+
+	chip8Message msg;
+	while (runner.popMessage(msg))
+		debugText.push(msg.text);
+
+	if (frame.sound != isBeeping)
 	{
-		myChip8.stopEmulation();
+		isBeeping = frame.sound;
+		if (isBeeping) { debugText.push("BEEP!"); }
 	}
 
-	updRegText(&regSStream, &regText);
-
 	window.clear();
 
-	// Update screen with pixels[] values and draw it
-	// Sacrificing LoC/executable size, for speed
-	if (myChip8.drawFlag)
+	// Upload pixels[] only when something was drawn,
+	// the texture is drawn in one call either way
+	const auto redraw = frame.drawCount != drawCount;
+	if (frame.state.hires != (screenW == 128))
 	{
-		for (size_t i = 0; i < screen.size(); i++)
-		{
-			screen[i].setFillColor(mem::pixels[i] ? fg_color : bg_color);
-			window.draw(screen[i]);
-		}
-		if (isDebug) { window.draw(draw_rec); }
-		myChip8.drawFlag = false;
+		resizeScreen(frame.state.hires, frame.state);
 	}
-	else
+	else if (redraw)
 	{
-		for (size_t i = 0; i < 64 * 32; i++)
-		{
-			window.draw(screen[i]);
-		}
+		updScreen(frame.state);
 	}
+	drawCount = frame.drawCount;
+	window.draw(screenSprite);
+	if (isDebug && redraw) { window.draw(draw_rec); }
 
 	//Draw to framebuffer and display
 	if (isDebug)
@@ -259,57 +385,120 @@ int main(int argc, char* argv[])
 		// Get fps
 		Framerate = short(1.f / Clock.getElapsedTime().asSeconds());
 		Clock.restart();
-		replaceText(&fpsText, std::to_string(Framerate));
+		snprintf(fpsLine, sizeof fpsLine, "%u", unsigned(Framerate));
+		fpsText.set(0, fpsLine);
+
+		updRegText(regText, frame);
+		updTraceText(traceText, frame);
 
 		// Draw all debug texts
 		window.draw(debugText);
+		window.draw(traceText);
 		window.draw(regText);
 		window.draw(fpsText);
 
-		if (myChip8.waitForKey) { window.draw(input_rec); }
+		if (frame.state.waitForKey) { window.draw(input_rec); }
 	}
 
 	window.display();
 	}
 
+	audio.stop();
+	runner.stop();
+
+	if (traceStream)
+	{
+		myChip8.setTraceStream(nullptr);
+		traceStream.reset();
+		traceWriter.reset();
+	}
+
+	if (!record_path.empty())
+	{
+		std::ofstream out(record_path, std::ios::binary);
+		if (!movie.save(out))
+		{
+			std::fprintf(stderr, "Can't write the movie %s\n", record_path.c_str());
+			return -1;
+		}
+	}
 	return 0;
 }
 
-//Update register values to regText
-static void updRegText(std::ostringstream* ss, sf::Text* regText)
+//Update register values to regText,
+//only the registers that changed are laid out again
+static void updRegText(textLines& regText, const chip8Frame& frame)
 {
-	ss->str("");
-	ss->clear();
-
-	for (auto i = 0; i < 16; i++)
+	char line[8];
+	for (unsigned i = 0; i < 16; i++)
 	{
-		*ss << "V" << i << "="
-			<< std::setw(2) << int(mem::V[i]) % 256 << "\n";
-		replaceText(regText, ss->str());
+		snprintf(line, sizeof line, "V%X=%02X", i, frame.state.V[i]);
+		regText.set(i, line);
 	}
 }
 
-void createScreen()
+//Scroll the instructions executed since the last time into traceText,
+//newest at the bottom. Each one is formatted only once.
+static void updTraceText(textLines& traceText, const chip8Frame& frame)
 {
-	for (size_t i = 0; i < 64 * 32; i++)
+	static unsigned lastCount = 0;
+
+	if (frame.traceCount == lastCount) { return; }
+
+	//More than fit, or the trace was cleared: start over with what there is
+	auto fresh = frame.traceCount - lastCount;
+	if (frame.traceCount < lastCount || fresh >= traceText.lines())
 	{
-		screen[i].setPosition(i % 64 * RES_MULT, i / 64 * RES_MULT);;
-		screen[i].setSize(sf::Vector2f(RES_MULT, RES_MULT));
-		screen[i].setFillColor(sf::Color(BG_COLOR));
+		traceText.clear();
+		fresh = frame.traceAvailable;
+	}
+	lastCount = frame.traceCount;
+
+	char line[128];
+	for (auto i = std::min(fresh, std::min(frame.traceAvailable, traceText.lines())); i-- > 0;)
+	{
+		formatTrace(frame.trace[i], line, sizeof line);
+		traceText.push(line);
 	}
 }
 
-void resizeScreen(bool isExtended)
+//Unpack pixels[] into the texture, the two planes pick one of four colors
+static void updScreen(const chip8State& state)
 {
-	auto size = isExtended ? 128 * 64 : 64 * 32;
-	auto sizeW = isExtended ? 128 : 64;
+	static const sf::Color colors[4] =
+	{
+		sf::Color(BG_COLOR), sf::Color(FG_COLOR), sf::Color(PLANE2_COLOR), sf::Color(BOTH_COLOR)
+	};
 
-	screen.clear();
-	screen.resize(size);
-	for (size_t i = 0; i < size; i++)
+	auto* out = screenRGBA.data();
+	for (unsigned y = 0; y < screenH; y++)
 	{
-		screen[i].setPosition(i % sizeW * RES_MULT/2, i / sizeW * RES_MULT/2);
-		screen[i].setSize(sf::Vector2f(RES_MULT/2, RES_MULT/2));
-		screen[i].setFillColor(sf::Color(BG_COLOR));
+		for (unsigned x = 0; x < screenW; x++)
+		{
+			const auto& c = colors[state.pixel(x, y, 0) | state.pixel(x, y, 1) << 1];
+			*out++ = c.r;
+			*out++ = c.g;
+			*out++ = c.b;
+			*out++ = c.a;
+		}
 	}
+	screenTexture.update(screenRGBA.data());
+}
+
+void createScreen()
+{
+	resizeScreen(false, myChip8);
+}
+
+void resizeScreen(bool isExtended, const chip8State& state)
+{
+	screenW = isExtended ? 128 : 64;
+	screenH = isExtended ? 64 : 32;
+	const float scale = isExtended ? RES_MULT / 2.f : RES_MULT;
+
+	screenTexture.create(screenW, screenH);
+	screenSprite.setTexture(screenTexture, true);
+	screenSprite.setScale(scale, scale);
+	screenRGBA.assign(screenW * screenH * 4, 0);
+	updScreen(state);
 }
\ No newline at end of file
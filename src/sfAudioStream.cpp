@@ -0,0 +1,22 @@
+#include "sfAudioStream.h"
+
+sfAudioStream::sfAudioStream(chip8Runner& r) : runner(r)
+{
+	initialize(1, runner.audioRate());
+}
+
+sfAudioStream::~sfAudioStream()
+{
+	// The stream thread must be gone before chunk is
+	stop();
+}
+
+bool sfAudioStream::onGetData(Chunk& data)
+{
+	// Always a full chunk, silence fills whatever the emulation
+	// didn't produce, so the stream never ends on its own
+	runner.readAudio(chunk, chunkSamples);
+	data.samples = chunk;
+	data.sampleCount = chunkSamples;
+	return true;
+}
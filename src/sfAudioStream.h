@@ -0,0 +1,30 @@
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#ifndef AUDIOSTREAM_H
+#define AUDIOSTREAM_H
+
+#include <SFML/Audio/SoundStream.hpp>
+
+#include "chip8-runner.h"
+
+// Plays the buzzer the runner synthesizes. SFML asks for the next
+// chunk on its own thread, which only copies samples out of the
+// runner's ring, so a short chunk keeps the latency low.
+class sfAudioStream : public sf::SoundStream
+{
+public:
+	explicit sfAudioStream(chip8Runner& runner);
+	~sfAudioStream();
+
+private:
+	static const unsigned chunkSamples = 512;	//~12ms at 44.1kHz
+
+	chip8Runner& runner;
+	sf::Int16 chunk[chunkSamples];
+
+	bool onGetData(Chunk& data) override;
+	void onSeek(sf::Time) override {}
+};
+#endif
@@ -0,0 +1,129 @@
+#include <algorithm>
+
+#include "sfDebugOverlay.h"
+
+glyphAtlas::glyphAtlas(const sf::Font& font, unsigned characterSize, bool bold)
+	: font(font), size(characterSize), spacing(font.getLineSpacing(characterSize))
+{
+	//sf::Text pads every quad by a texel so filtering doesn't cut off edges
+	const float pad = 1.f;
+
+	for (unsigned c = 0; c < count; c++)
+	{
+		const auto& g = font.getGlyph(first + c, size, bold);
+		glyphs[c].bounds = sf::FloatRect(g.bounds.left - pad, g.bounds.top - pad,
+			g.bounds.width + 2 * pad, g.bounds.height + 2 * pad);
+		glyphs[c].uv = sf::FloatRect(g.textureRect.left - pad, g.textureRect.top - pad,
+			g.textureRect.width + 2 * pad, g.textureRect.height + 2 * pad);
+		glyphs[c].advance = g.advance;
+	}
+}
+
+void glyphAtlas::layout(const char* text, const sf::Color& color, sf::Vertex* out, unsigned maxChars) const
+{
+	float x = 0;
+	const float y = float(size);
+	unsigned n = 0;
+
+	for (; n < maxChars && text[n]; n++, out += 6)
+	{
+		auto c = (unsigned char)text[n];
+		if (c < first || c >= first + count) { c = '?'; }
+		const auto& g = glyphs[c - first];
+
+		const float
+			l = x + g.bounds.left, r = l + g.bounds.width,
+			t = y + g.bounds.top, b = t + g.bounds.height,
+			u0 = g.uv.left, u1 = u0 + g.uv.width,
+			v0 = g.uv.top, v1 = v0 + g.uv.height;
+
+		out[0] = sf::Vertex(sf::Vector2f(l, t), color, sf::Vector2f(u0, v0));
+		out[1] = sf::Vertex(sf::Vector2f(r, t), color, sf::Vector2f(u1, v0));
+		out[2] = sf::Vertex(sf::Vector2f(l, b), color, sf::Vector2f(u0, v1));
+		out[3] = out[2];
+		out[4] = out[1];
+		out[5] = sf::Vertex(sf::Vector2f(r, b), color, sf::Vector2f(u1, v1));
+
+		x += g.advance;
+	}
+
+	//Zero area triangles draw nothing
+	for (; n < maxChars; n++, out += 6)
+		std::fill_n(out, 6, sf::Vertex());
+}
+
+textLines::textLines(const glyphAtlas& atlas, unsigned lines, unsigned columns, const sf::Color& color)
+	: atlas(atlas), columns(columns), color(color),
+	text(lines), vertices(size_t(lines) * columns * 6)
+{
+}
+
+void textLines::set(unsigned line, const char* st)
+{
+	if (line >= lines()) { return; }
+
+	const unsigned slot = (top + line) % lines();
+	if (text[slot] == st) { return; }
+
+	text[slot] = st;
+	render(slot);
+	used = std::max(used, line + 1);
+}
+
+void textLines::push(const char* st)
+{
+	if (used < lines())
+	{
+		set(used, st);
+		return;
+	}
+
+	//Reuse the top slot as the new bottom line
+	const unsigned slot = top;
+	top = (top + 1) % lines();
+	text[slot] = st;
+	render(slot);
+}
+
+void textLines::clear()
+{
+	for (auto& t : text)
+		t.clear();
+	std::fill(vertices.begin(), vertices.end(), sf::Vertex());
+	top = 0;
+	used = 0;
+}
+
+void textLines::render(unsigned slot)
+{
+	sf::Vertex* out = &vertices[size_t(slot) * columns * 6];
+	atlas.layout(text[slot].c_str(), color, out, columns);
+
+	//Vertices stay at their slot's row, see draw()
+	const float y = slot * atlas.lineSpacing();
+	for (unsigned i = 0; i < columns * 6; i++)
+		out[i].position.y += y;
+}
+
+void textLines::draw(sf::RenderTarget& target, sf::RenderStates states) const
+{
+	if (vertices.empty()) { return; }
+
+	states.transform *= getTransform();
+	states.texture = &atlas.texture();
+
+	//Slots top.. are lines 0.., the slots before top follow them
+	const float row = atlas.lineSpacing();
+	const size_t perSlot = size_t(columns) * 6;
+
+	sf::RenderStates upper = states;
+	upper.transform.translate(0, -row * top);
+	target.draw(&vertices[top * perSlot], (lines() - top) * perSlot, sf::Triangles, upper);
+
+	if (top)
+	{
+		sf::RenderStates lower = states;
+		lower.transform.translate(0, row * (lines() - top));
+		target.draw(&vertices[0], top * perSlot, sf::Triangles, lower);
+	}
+}
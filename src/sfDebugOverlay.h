@@ -0,0 +1,79 @@
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#ifndef DEBUGOVERLAY_H
+#define DEBUGOVERLAY_H
+
+#include <SFML/Graphics.hpp>
+#include <string>
+#include <vector>
+
+// The printable ASCII glyphs of one font at one size, looked up once.
+// Asking the font for all of them up front renders them into its texture
+// page, after that laying out a line is only copying quads out of a table.
+class glyphAtlas
+{
+public:
+	glyphAtlas(const sf::Font& font, unsigned characterSize, bool bold = false);
+
+	const sf::Texture& texture() const { return font.getTexture(size); }
+	float lineSpacing() const { return spacing; }
+
+	// Writes two triangles per character of text into out, at most
+	// maxChars of them, with the baseline of the line at y = size.
+	// Unused quads up to maxChars are collapsed to nothing.
+	void layout(const char* text, const sf::Color& color, sf::Vertex* out, unsigned maxChars) const;
+
+private:
+	struct glyph
+	{
+		sf::FloatRect bounds;	//Quad relative to the pen, padded like sf::Text
+		sf::FloatRect uv;		//Same in texture pixels
+		float advance;
+	};
+
+	static const unsigned first = 0x20, count = 0x7F - 0x20;
+
+	const sf::Font& font;
+	unsigned size;
+	float spacing;
+	glyph glyphs[count];
+};
+
+// A fixed number of lines of text drawn from a glyphAtlas.
+//
+// Every line owns its slot of vertices and keeps the text it shows, so
+// set() with the same text again costs a string compare and nothing is
+// laid out. Used as a ring, push() overwrites the oldest slot only and
+// the others are scrolled by the transform they are drawn with.
+// Either way the whole block is at most two draw calls.
+class textLines : public sf::Drawable, public sf::Transformable
+{
+public:
+	textLines(const glyphAtlas& atlas, unsigned lines, unsigned columns, const sf::Color& color);
+
+	unsigned lines() const { return unsigned(text.size()); }
+
+	// Line 0 is at the top, text past columns is cut off
+	void set(unsigned line, const char* st);
+
+	// Appends a line at the bottom, once all are used the top one scrolls out
+	void push(const char* st);
+
+	void clear();
+
+private:
+	const glyphAtlas& atlas;
+	unsigned columns;
+	sf::Color color;
+
+	std::vector<std::string> text;		//By slot
+	std::vector<sf::Vertex> vertices;	//columns * 6 per slot, laid out at the slot's row
+	unsigned top = 0;					//Slot shown on line 0
+	unsigned used = 0;					//Lines filled by push()
+
+	void draw(sf::RenderTarget& target, sf::RenderStates states) const override;
+	void render(unsigned slot);
+};
+#endif
@@ -0,0 +1,73 @@
+// Decodes a trace file written through chip8TraceWriter and prints
+// every instruction of one stream the way the debug overlay shows it
+// (formatTrace), oldest first.
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "chip8-tracefile.h"
+
+static int usage()
+{
+	std::fprintf(stderr,
+		"usage: chip8-tracedump [-s stream] [-a] [-l] file\n"
+		"  -s <n>  stream to print (default: 0)\n"
+		"  -a      start every line with the instruction's address\n"
+		"  -l      list the streams with their entries instead\n");
+	return 2;
+}
+
+int main(int argc, char* argv[])
+{
+	std::string path;
+	unsigned only = 0;
+	bool addresses = false, list = false;
+	for (int i = 1; i < argc; i++)
+	{
+		const std::string arg = argv[i];
+		if (arg == "-s" && i + 1 < argc) { only = unsigned(std::strtoul(argv[++i], nullptr, 0)); }
+		else if (arg == "-a") { addresses = true; }
+		else if (arg == "-l") { list = true; }
+		else if (arg[0] == '-' || !path.empty()) { return usage(); }
+		else { path = arg; }
+	}
+	if (path.empty()) { return usage(); }
+
+	std::ifstream in(path, std::ios::binary);
+	chip8TraceReader reader;
+	if (!in || !reader.open(in))
+	{
+		std::fprintf(stderr, "%s is no trace file\n", path.c_str());
+		return 1;
+	}
+
+	std::map<unsigned, unsigned long long> counts;
+	std::vector<traceEntry> entries;
+	unsigned stream;
+	char line[64];
+	while (reader.next(stream, entries))
+	{
+		counts[stream] += entries.size();
+		if (list || stream != only) { continue; }
+
+		for (const auto& e : entries)
+		{
+			formatTrace(e, line, sizeof line);
+			if (addresses) { std::printf("%03X %s\n", e.pc, line); }
+			else { std::printf("%s\n", line); }
+		}
+	}
+
+	if (reader.truncated()) { std::fprintf(stderr, "%s: the last chunk is cut short\n", path.c_str()); }
+
+	if (list)
+	{
+		for (const auto& c : counts)
+			std::printf("stream %u: %llu instructions\n", c.first, c.second);
+	}
+	return 0;
+}